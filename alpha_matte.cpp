@@ -0,0 +1,83 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "alpha_matte.h"
+#include <algorithm>
+
+// alpha at or above this counts as opaque when choosing the table
+static const uint8_t OPAQUE_THRESHOLD = 128;
+
+alpha_matte::alpha_matte() : tables( TABLE_SIZE * 2 )
+{
+}
+
+// millimetres to depth units, rounded
+static int to_units( uint16_t mm, float meters_per_unit )
+{
+  return (int)(mm * 0.001f / meters_per_unit + 0.5f);
+}
+
+void alpha_matte::update( const alpha_matte_settings & settings, float meters_per_unit )
+{
+  if ( built && settings == current && meters_per_unit == current_units ) return;
+  current = settings;
+  current_units = meters_per_unit;
+  near_units = to_units( settings.near_depth, meters_per_unit );
+  far_units = to_units( settings.far_depth, meters_per_unit );
+  feather_units = to_units( settings.feather, meters_per_unit );
+  build_table( tables.data(), 0 );
+  build_table( tables.data() + TABLE_SIZE, to_units( settings.hysteresis, meters_per_unit ) );
+  built = true;
+}
+
+void alpha_matte::build_table( uint8_t * table, int widen )
+{
+  const int lo = std::max( 1, near_units - widen );
+  const int hi = far_units + widen;
+  const int feather = feather_units;
+  for ( int d = 0; d < (int)TABLE_SIZE; d++ )
+  {
+    int outside = d < lo ? lo - d : d > hi ? d - hi : 0;
+    if ( outside == 0 )             table[d] = 255;
+    else if ( outside >= feather )  table[d] = 0;
+    else                            table[d] = (uint8_t)(255 * (feather - outside) / feather);
+  }
+  // depth 0 is a hole, key_row keeps previous alpha for it
+  table[0] = 0;
+}
+
+void alpha_matte::resize( size_t width, size_t height )
+{
+  if ( width == matte_width && height == matte_height ) return;
+  matte_width = width;
+  matte_height = height;
+  alpha.assign( width * height, 0 );
+}
+
+void alpha_matte::key_row( const uint16_t * depth, size_t row )
+{
+  uint8_t * a = alpha.data() + row * matte_width;
+  const uint8_t * transparent = tables.data();
+  const uint8_t * opaque = tables.data() + TABLE_SIZE;
+  for ( size_t i = 0; i < matte_width; i++ )
+  {
+    uint16_t d = depth[i];
+    if ( d == 0 ) continue;
+    a[i] = (a[i] >= OPAQUE_THRESHOLD ? opaque : transparent)[d];
+  }
+}
@@ -0,0 +1,79 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Where depth keys the color image, in millimetres so that it does not
+// depend on depth units camera is set to. Default range is the same as
+// default depth clamp.
+struct alpha_matte_settings
+{
+  // opaque between near and far
+  uint16_t near_depth{ 1000 };
+  uint16_t far_depth{ 3550 };
+  // alpha falls to zero over this many millimetres outside [near, far], 0 for a hard edge
+  uint16_t feather{ 50 };
+  // pixels that were opaque stay so until depth leaves the range widened by this
+  uint16_t hysteresis{ 20 };
+  bool operator==( const alpha_matte_settings & other ) const
+  {
+    return near_depth == other.near_depth && far_depth == other.far_depth &&
+           feather == other.feather && hysteresis == other.hysteresis;
+  }
+  bool operator!=( const alpha_matte_settings & other ) const { return !(*this == other); }
+};
+
+// Alpha for every depth pixel of a stream, carried over from frame to frame.
+// Alpha comes from tables indexed by depth, one for pixels that were
+// transparent on previous frame and a wider one for pixels that were
+// opaque, so edges do not flicker when depth noise crosses a threshold.
+// Pixels without depth keep their previous alpha. Rows can be keyed from
+// several threads at once, other calls must not overlap with keying.
+class alpha_matte
+{
+public:
+  static const size_t TABLE_SIZE = 65536;
+  alpha_matte();
+  // Rebuilds tables for depth in units of meters_per_unit, if settings or
+  // units differ from previous call.
+  void update( const alpha_matte_settings & settings, float meters_per_unit );
+  // Sets size of keyed depth, clearing alpha if it changed.
+  void resize( size_t width, size_t height );
+  // Keys one row of width depth values into alpha of row.
+  void key_row( const uint16_t * depth, size_t row );
+  const uint8_t * alpha_row( size_t row ) const { return alpha.data() + row * matte_width; }
+  size_t width() const { return matte_width; }
+  size_t height() const { return matte_height; }
+protected:
+  // TABLE_SIZE entries for transparent pixels, then TABLE_SIZE for opaque ones
+  std::vector<uint8_t> tables;
+  std::vector<uint8_t> alpha;
+  size_t matte_width{ 0 };
+  size_t matte_height{ 0 };
+  alpha_matte_settings current;
+  float current_units{ 0.0f };
+  // current settings in depth units
+  int near_units{ 0 };
+  int far_units{ 0 };
+  int feather_units{ 0 };
+  bool built{ false };
+  void build_table( uint8_t * table, int widen );
+};
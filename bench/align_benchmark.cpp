@@ -0,0 +1,100 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+// Compares rs2::align against depth_aligner on frames from a recorded .bag file.
+//
+//   realsense-align-benchmark recording.bag [frames]
+#include <librealsense2/rs.hpp>
+#include "depth_aligner.h"
+#include "bench_common.h"
+#include <algorithm>
+#include <cstdlib>
+using namespace std;
+
+int main( int argc, char **argv )
+{
+  if ( argc < 2 )
+  {
+    cerr << "usage: " << argv[0] << " recording.bag [frames]\n";
+    return 1;
+  }
+  size_t frame_count = argc > 2 ? (size_t)atoi(argv[2]) : 300;
+  try
+  {
+    rs2::config cfg;
+    cfg.enable_device_from_file(argv[1], false);
+    cfg.enable_stream(RS2_STREAM_DEPTH, RS2_FORMAT_Z16);
+    cfg.enable_stream(RS2_STREAM_COLOR);
+    rs2::pipeline pipe;
+    rs2::pipeline_profile profile = pipe.start(cfg);
+    // process every recorded frame instead of dropping them to keep real time
+    profile.get_device().as<rs2::playback>().set_real_time(false);
+
+    rs2::align rs_align(RS2_STREAM_COLOR);
+    depth_aligner cached;
+    vector<uint16_t> cached_output;
+    latency_samples rs_times("rs2::align");
+    latency_samples cached_times("depth_aligner");
+    size_t compared = 0, matching = 0;
+
+    for ( size_t i = 0; i < frame_count; i++ )
+    {
+      rs2::frameset frames;
+      if ( !pipe.try_wait_for_frames(&frames, 1000) ) break;
+      rs2::depth_frame depth = frames.get_depth_frame();
+      rs2::video_frame color = frames.get_color_frame();
+      if ( !depth || !color ) continue;
+
+      stopwatch rs_watch;
+      rs2::frameset aligned = rs_align.process(frames);
+      rs2::depth_frame rs_depth = aligned.get_depth_frame();
+      rs_times.add(rs_watch.elapsed_us());
+
+      stopwatch cached_watch;
+      cached.align(depth, depth, color, cached_output);
+      cached_times.add(cached_watch.elapsed_us());
+
+      // agreement of the two results, off by one millimeter is considered
+      // equal; in depth units, which are 0.1 mm by default
+      const int tolerance = max( 1, (int)(0.001f / depth.get_units() + 0.5f) );
+      const uint16_t *rs_data = reinterpret_cast<const uint16_t *>(rs_depth.get_data());
+      for ( size_t p = 0; p < cached_output.size(); p++ )
+      {
+        if ( rs_data[p] == 0 && cached_output[p] == 0 ) continue;
+        compared++;
+        if ( abs((int)rs_data[p] - (int)cached_output[p]) <= tolerance ) matching++;
+      }
+    }
+    pipe.stop();
+
+    latency_samples::print_header(cout);
+    rs_times.print(cout);
+    cached_times.print(cout);
+    cout << "frames " << rs_times.count() << ", mapping rebuilt " << cached.rebuild_count() << " times\n";
+    cout << "pixels matching rs2::align: "
+         << (compared ? 100.0 * matching / compared : 100.0) << "%\n";
+  }
+  catch ( rs2::error & e )
+  {
+    cerr << "RealSense error calling " << e.get_failed_function() << "(" << e.get_failed_args() << "):\n    " << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
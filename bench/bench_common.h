@@ -0,0 +1,198 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+// Helpers shared by benchmark programs. Programs not linking librealsense
+// define BENCH_NO_REALSENSE before including this, which leaves out frame
+// sources.
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#if !defined(BENCH_NO_REALSENSE)
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <librealsense2/rs.hpp>
+#include <librealsense2/hpp/rs_internal.hpp>
+#endif
+
+// Collects duration samples and reports percentiles.
+class latency_samples
+{
+public:
+  explicit latency_samples( const std::string & stage_name ) : name(stage_name) {}
+  void add( double microseconds ) { samples.push_back(microseconds); }
+  size_t count() const { return samples.size(); }
+  double percentile( double p ) const
+  {
+    if ( samples.empty() ) return 0.0;
+    std::vector<double> sorted = samples;
+    std::sort(sorted.begin(), sorted.end());
+    size_t i = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[i];
+  }
+  double mean() const
+  {
+    double sum = 0.0;
+    for ( double s : samples ) sum += s;
+    return samples.empty() ? 0.0 : sum / samples.size();
+  }
+  void print( std::ostream & out ) const
+  {
+    out << std::left << std::setw(24) << name << std::right << std::fixed << std::setprecision(1)
+        << " mean " << std::setw(9) << mean()
+        << "  p50 " << std::setw(9) << percentile(50)
+        << "  p90 " << std::setw(9) << percentile(90)
+        << "  p99 " << std::setw(9) << percentile(99)
+        << "  max " << std::setw(9) << percentile(100) << " us\n";
+  }
+  static void print_header( std::ostream & out )
+  {
+    out << std::left << std::setw(24) << "stage" << " (" << "microseconds per frame)\n";
+  }
+  std::string name;
+protected:
+  std::vector<double> samples;
+};
+
+// Measures time elapsed since construction.
+class stopwatch
+{
+public:
+  stopwatch() : start(std::chrono::steady_clock::now()) {}
+  double elapsed_us() const
+  {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  }
+protected:
+  std::chrono::steady_clock::time_point start;
+};
+
+#if !defined(BENCH_NO_REALSENSE)
+class frame_source
+{
+public:
+  virtual ~frame_source() {}
+  virtual bool next( rs2::frameset & frames ) = 0;
+};
+
+// Plays back a recording as fast as frames are consumed.
+class bag_source : public frame_source
+{
+public:
+  bag_source( const std::string & file, rs2_format color_format )
+  {
+    rs2::config cfg;
+    cfg.enable_device_from_file(file, true);
+    cfg.enable_stream(RS2_STREAM_DEPTH, RS2_FORMAT_Z16);
+    cfg.enable_stream(RS2_STREAM_COLOR, color_format);
+    rs2::pipeline_profile profile = pipe.start(cfg);
+    profile.get_device().as<rs2::playback>().set_real_time(false);
+    auto color = profile.get_stream(RS2_STREAM_COLOR).as<rs2::video_stream_profile>();
+    width = color.width();
+    height = color.height();
+  }
+  virtual ~bag_source() { pipe.stop(); }
+  virtual bool next( rs2::frameset & frames ) { return pipe.try_wait_for_frames(&frames, 5000); }
+  int width, height;
+protected:
+  rs2::pipeline pipe;
+};
+
+// Depth of pixel x, y in buffer i of synthetic_source, rng adds noise.
+typedef std::function<uint16_t( int x, int y, int i, std::mt19937 & rng )> depth_generator;
+
+// depth ramps with noise, in 0.1 mm units
+inline uint16_t ramp_depth( int x, int y, int, std::mt19937 & rng )
+{
+  return (uint16_t)(5000 + x * 40 + y * 10 + rng() % 200);
+}
+
+// Generates depth with generator and random color through a software
+// device. Frames point into buffer_count buffers, cycled through, so there
+// must be more of them than frames held at a time.
+class synthetic_source : public frame_source
+{
+public:
+  synthetic_source( int w, int h, rs2_format color_format = RS2_FORMAT_RGB8, int buffer_count = 8,
+                    float depth_units = 0.0001f, depth_generator generate = ramp_depth ) :
+    width(w), height(h), color_bpp(color_format == RS2_FORMAT_YUYV ? 2 : 3),
+    depth(buffer_count), color(buffer_count)
+  {
+    rs2_intrinsics intrinsics = { w, h, w / 2.0f, h / 2.0f, w * 0.75f, w * 0.75f, RS2_DISTORTION_NONE, { 0, 0, 0, 0, 0 } };
+    depth_sensor = dev.add_sensor("Depth");
+    color_sensor = dev.add_sensor("Color");
+    depth_profile = depth_sensor.add_video_stream({ RS2_STREAM_DEPTH, 0, 0, w, h, 30, 2, RS2_FORMAT_Z16, intrinsics });
+    color_profile = color_sensor.add_video_stream({ RS2_STREAM_COLOR, 0, 1, w, h, 30, color_bpp, color_format, intrinsics });
+    depth_sensor.add_read_only_option(RS2_OPTION_DEPTH_UNITS, depth_units);
+    // color camera 15 mm beside depth camera, like on D400
+    depth_profile.register_extrinsics_to(color_profile, { { 1, 0, 0, 0, 1, 0, 0, 0, 1 }, { 0.015f, 0, 0 } });
+    dev.create_matcher(RS2_MATCHER_DLR_C);
+    depth_sensor.open(depth_profile);
+    color_sensor.open(color_profile);
+    depth_sensor.start(sync);
+    color_sensor.start(sync);
+
+    std::mt19937 rng(1234);
+    for ( int i = 0; i < buffer_count; i++ )
+    {
+      depth[i].resize((size_t)w * h);
+      color[i].resize((size_t)w * h * color_bpp);
+      for ( int y = 0; y < h; y++ )
+        for ( int x = 0; x < w; x++ )
+          depth[i][(size_t)y * w + x] = generate(x, y, i, rng);
+      for ( auto & c : color[i] ) c = (uint8_t)rng();
+    }
+  }
+  virtual ~synthetic_source()
+  {
+    depth_sensor.stop();
+    color_sensor.stop();
+    depth_sensor.close();
+    color_sensor.close();
+  }
+  virtual bool next( rs2::frameset & frames )
+  {
+    int i = frame_number % (int)depth.size();
+    double timestamp = frame_number * 1000.0 / 30.0;
+    depth_sensor.on_video_frame({ depth[i].data(), [](void*){}, width * 2, 2, timestamp,
+                                  RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK, frame_number, depth_profile.get() });
+    color_sensor.on_video_frame({ color[i].data(), [](void*){}, width * color_bpp, color_bpp, timestamp,
+                                  RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK, frame_number, color_profile.get() });
+    frame_number++;
+    return sync.try_wait_for_frames(&frames, 5000);
+  }
+  int width, height;
+  // bytes per color pixel, as they would come over USB
+  int color_bpp;
+protected:
+  std::vector<std::vector<uint16_t>> depth;
+  std::vector<std::vector<uint8_t>> color;
+  rs2::software_device dev;
+  rs2::software_sensor depth_sensor;
+  rs2::software_sensor color_sensor;
+  rs2::stream_profile depth_profile;
+  rs2::stream_profile color_profile;
+  rs2::syncer sync;
+  int frame_number{ 0 };
+};
+#endif
@@ -0,0 +1,209 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+// Reads filtered depth the plugin publishes into shared memory, and
+// prints each second how many frames arrived, how many were missed or
+// overwritten while being read, and how long after publishing they were
+// read. Also serves as an example of depth_export_reader.
+//
+//   realsense-depth-export-client --serial SERIAL | --name /region [--seconds T]
+//   realsense-depth-export-client --self-test [--seconds T] [--size WxH]
+//
+// --self-test forks a writer that publishes as fast as it can, resizing
+// frames halfway, and checks that no frame passing still_valid was torn.
+// Exits with status 2 if one was.
+#include "depth_export.h"
+// only reads shared memory, does not need librealsense
+#define BENCH_NO_REALSENSE
+#include "bench_common.h"
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+using namespace std;
+
+static void usage( const char *name )
+{
+  cerr << "usage: " << name << " --serial SERIAL | --name /region [--seconds T]\n"
+       << "       " << name << " --self-test [--seconds T] [--size WxH]\n";
+}
+
+// what self-test writer puts in pixel i of frame n
+static inline uint16_t test_pattern( uint64_t frame_number, size_t i )
+{
+  return (uint16_t)(frame_number * 7 + i);
+}
+
+static void run_test_writer( const string & name, int width, int height, double seconds )
+{
+  depth_export_writer writer;
+  if ( !writer.open( name, (size_t)width * height ) ) exit(1);
+  vector<uint16_t> depth;
+  latency_samples publish_us("publish");
+  stopwatch total;
+  bool resized = false;
+  for ( uint64_t n = 1; total.elapsed_us() < seconds * 1e6; n++ )
+  {
+    // larger frames replace region, readers have to follow
+    if ( !resized && total.elapsed_us() > seconds * 0.5e6 )
+    {
+      width *= 2;
+      height *= 2;
+      resized = writer.open( name, (size_t)width * height );
+    }
+    depth.resize((size_t)width * height);
+    for ( size_t i = 0; i < depth.size(); i++ ) depth[i] = test_pattern(n, i);
+    depth_export_info info = depth_export_info();
+    info.frame_number = n;
+    info.timestamp = n;
+    info.depth_units = 0.001f;
+    info.width = width;
+    info.height = height;
+    info.intrinsics.width = width;
+    info.intrinsics.height = height;
+    stopwatch watch;
+    writer.publish( info, depth.data(), width * sizeof(uint16_t) );
+    publish_us.add(watch.elapsed_us());
+  }
+  cout << "writer published " << writer.frames_published() << " frames after resize\n";
+  publish_us.print(cout);
+}
+
+// Reads for given time, checking pixels against test_pattern when testing.
+// Returns number of frames torn without still_valid noticing, and width of
+// last frame read in last_width.
+static size_t run_reader( const string & name, double seconds, bool self_test, uint32_t & last_width )
+{
+  depth_export_reader reader;
+  stopwatch total;
+  while ( !reader.open(name) )
+  {
+    if ( total.elapsed_us() > 5e6 )
+    {
+      cerr << "no shared memory " << name << ", is depth sharing enabled?\n";
+      return 0;
+    }
+    this_thread::sleep_for(chrono::milliseconds(10));
+  }
+  latency_samples latency_us("publish to read");
+  size_t frames = 0, torn = 0, undetected = 0;
+  uint32_t last_height = 0;
+  last_width = 0;
+  uint64_t missed_before = 0;
+  bool intrinsics_shown = false;
+  stopwatch second;
+  while ( total.elapsed_us() < seconds * 1e6 )
+  {
+    depth_export_view view;
+    if ( !reader.wait(view, 1000) ) continue;
+    latency_us.add((depth_export_now_ns() - view.info.published_ns) / 1000.0);
+    size_t pixels = (size_t)view.info.width * view.info.height;
+    bool matches = true;
+    uint16_t center = view.depth[pixels / 2 + view.info.width / 2];
+    if ( self_test )
+    {
+      for ( size_t i = 0; i < pixels; i++ )
+        if ( view.depth[i] != test_pattern(view.info.frame_number, i) ) { matches = false; break; }
+    }
+    // pixels and anything computed from them only count if frame was not overwritten meanwhile
+    if ( !reader.still_valid(view) ) { torn++; continue; }
+    if ( !matches ) undetected++;
+    frames++;
+    last_width = view.info.width;
+    last_height = view.info.height;
+    if ( !intrinsics_shown )
+    {
+      const depth_export_intrinsics & in = view.info.intrinsics;
+      cout << view.info.width << "x" << view.info.height << " depth, fx " << in.fx << " fy " << in.fy
+           << " ppx " << in.ppx << " ppy " << in.ppy << ", " << view.info.depth_units << " m per unit\n";
+      intrinsics_shown = true;
+    }
+    if ( !self_test && second.elapsed_us() >= 1e6 )
+    {
+      cout << fixed << setprecision(1) << frames / (second.elapsed_us() * 1e-6) << " fps, "
+           << reader.frames_missed() - missed_before << " missed, " << torn << " overwritten while read, "
+           << "latency p50 " << latency_us.percentile(50) << " us, center "
+           << setprecision(3) << center * view.info.depth_units << " m\n";
+      missed_before = reader.frames_missed();
+      frames = torn = 0;
+      second = stopwatch();
+    }
+  }
+  if ( self_test )
+  {
+    cout << "reader got " << frames << " frames, missed " << reader.frames_missed() << ", "
+         << torn << " overwritten while read and detected, " << undetected << " torn undetected, "
+         << "last " << last_width << "x" << last_height << "\n";
+  }
+  latency_samples::print_header(cout);
+  latency_us.print(cout);
+  return undetected;
+}
+
+int main( int argc, char **argv )
+{
+  string name;
+  double seconds = 10.0;
+  bool self_test = false;
+  int width = 424, height = 240;
+  for ( int i = 1; i < argc; i++ )
+  {
+    string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if ( arg == "--serial" && has_value ) name = string(DEPTH_EXPORT_NAME_PREFIX) + argv[++i];
+    else if ( arg == "--name" && has_value ) name = argv[++i];
+    else if ( arg == "--seconds" && has_value ) seconds = atof(argv[++i]);
+    else if ( arg == "--size" && has_value && sscanf(argv[++i], "%dx%d", &width, &height) == 2 ) {}
+    else if ( arg == "--self-test" ) self_test = true;
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if ( !self_test )
+  {
+    if ( name.empty() ) { usage(argv[0]); return 1; }
+    uint32_t last_width;
+    run_reader(name, seconds, false, last_width);
+    return 0;
+  }
+
+  // macOS allows names of at most 31 characters
+  name = "/realsense-depth-test-" + to_string(getpid());
+  pid_t writer = fork();
+  if ( writer < 0 ) { perror("fork"); return 1; }
+  if ( writer == 0 )
+  {
+    run_test_writer(name, width, height, seconds);
+    return 0;
+  }
+  uint32_t last_width;
+  size_t undetected = run_reader(name, seconds, true, last_width);
+  int status = 0;
+  waitpid(writer, &status, 0);
+  if ( undetected > 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || last_width != (uint32_t)width * 2 )
+  {
+    cout << "FAILED\n";
+    return 2;
+  }
+  cout << "passed\n";
+  return 0;
+}
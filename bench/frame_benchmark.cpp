@@ -0,0 +1,393 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Feeds framesets through obs_frame_processor without OBS or a camera and
+// reports latency of each processing stage, throughput and heap
+// allocations per frame. Frames come from a recorded .bag file, or are
+// generated through rs2::software_device when no file is given.
+//
+//   realsense-frame-benchmark [--bag recording.bag] [--frames N] [--size WxH]
+//                             [--raw-depth] [--align none|librealsense|cached]
+//                             [--threads N | --scaling] [--color rgb8|yuyv]
+//                             [--check-allocations]
+//
+// --check-allocations fails with exit status 2 if anything is allocated
+// while processing, handing off or publishing frames after warm-up.
+#include <librealsense2/rs.hpp>
+#include <librealsense2/hpp/rs_internal.hpp>
+#include "obs_frame_processor.h"
+#include "realsense-device.h"
+#include "pixel_kernels.h"
+#include "bench_common.h"
+#include "frame_mailbox.h"
+#include "frame_stats.h"
+#include "thread_pool.h"
+#include "triple_buffer.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+using namespace std;
+
+// Every heap allocation in the process goes through these and is counted:
+// plain, array and nothrow forms, and aligned ones where the standard
+// library has them.
+static atomic<uint64_t> allocation_count{ 0 };
+
+static void * counted_malloc( size_t size )
+{
+  allocation_count++;
+  return malloc(size ? size : 1);
+}
+
+void * operator new( size_t size )
+{
+  void *p = counted_malloc(size);
+  if ( p == nullptr ) throw bad_alloc();
+  return p;
+}
+
+void * operator new[]( size_t size )
+{
+  void *p = counted_malloc(size);
+  if ( p == nullptr ) throw bad_alloc();
+  return p;
+}
+
+void * operator new( size_t size, const nothrow_t & ) noexcept
+{
+  return counted_malloc(size);
+}
+
+void * operator new[]( size_t size, const nothrow_t & ) noexcept
+{
+  return counted_malloc(size);
+}
+
+void operator delete( void * p ) noexcept
+{
+  free(p);
+}
+
+void operator delete[]( void * p ) noexcept
+{
+  free(p);
+}
+
+void operator delete( void * p, const nothrow_t & ) noexcept
+{
+  free(p);
+}
+
+void operator delete[]( void * p, const nothrow_t & ) noexcept
+{
+  free(p);
+}
+
+#if defined(__cpp_aligned_new)
+static void * counted_aligned_malloc( size_t size, align_val_t alignment )
+{
+  allocation_count++;
+  size_t align = max( (size_t)alignment, sizeof(void *) );
+  void *p = nullptr;
+  if ( posix_memalign( &p, align, size ? size : 1 ) != 0 ) return nullptr;
+  return p;
+}
+
+void * operator new( size_t size, align_val_t alignment )
+{
+  void *p = counted_aligned_malloc(size, alignment);
+  if ( p == nullptr ) throw bad_alloc();
+  return p;
+}
+
+void * operator new[]( size_t size, align_val_t alignment )
+{
+  void *p = counted_aligned_malloc(size, alignment);
+  if ( p == nullptr ) throw bad_alloc();
+  return p;
+}
+
+void * operator new( size_t size, align_val_t alignment, const nothrow_t & ) noexcept
+{
+  return counted_aligned_malloc(size, alignment);
+}
+
+void * operator new[]( size_t size, align_val_t alignment, const nothrow_t & ) noexcept
+{
+  return counted_aligned_malloc(size, alignment);
+}
+
+void operator delete( void * p, align_val_t ) noexcept
+{
+  free(p);
+}
+
+void operator delete[]( void * p, align_val_t ) noexcept
+{
+  free(p);
+}
+#endif
+
+static void usage( const char *name )
+{
+  cerr << "usage: " << name << " [--bag recording.bag] [--frames N] [--size WxH]\n"
+       << "       [--raw-depth] [--align none|librealsense|cached] [--threads N | --scaling]\n"
+       << "       [--mapping N] [--layout N] [--color rgb8|yuyv] [--check-allocations]\n"
+       << "mappings:";
+  for ( int m = 0; m < DEPTH_MAP_COUNT; m++ ) cerr << " " << m << "=" << depth_mapping_name(m);
+  cerr << "\nlayouts:";
+  for ( int l = 0; l < LAYOUT_COUNT; l++ ) cerr << " " << l << "=" << output_layout_name(l);
+  cerr << "\n";
+}
+
+struct benchmark_options
+{
+  string bag;
+  size_t frame_count{ 600 };
+  int width{ DEFAULT_STREAM_WIDTH };
+  int height{ DEFAULT_STREAM_HEIGHT };
+  bool raw_depth{ false };
+  int alignment{ DEPTH_ALIGN_NONE };
+  int mapping{ DEPTH_MAP_STEPS };
+  int layout{ LAYOUT_SIDE_BY_SIDE };
+  rs2_format color_format{ RS2_FORMAT_RGB8 };
+  // compositing threads, including the one calling update_context
+  size_t threads{ 1 };
+};
+
+struct benchmark_result
+{
+  vector<latency_samples> stages;
+  latency_samples total{ "total" };
+  uint64_t allocations{ 0 };
+  size_t bytes_copied{ 0 };
+  double busy_us{ 0.0 };
+  size_t measured{ 0 };
+  double fps() const { return busy_us > 0.0 ? measured / (busy_us * 1e-6) : 0.0; }
+};
+
+static void run_benchmark( benchmark_options & options, thread_pool & pool, benchmark_result & result )
+{
+  const size_t WARMUP_FRAMES = 30;
+  frame_source *source;
+  if ( !options.bag.empty() )
+  {
+    bag_source *b = new bag_source(options.bag, options.color_format);
+    options.width = b->width;
+    options.height = b->height;
+    source = b;
+  }
+  else
+  {
+    source = new synthetic_source(options.width, options.height, options.color_format);
+  }
+
+  // device is never started, processor only reads its settings
+  realsense_device dev("benchmark");
+  dev.align = new rs2::align(RS2_STREAM_COLOR);
+  dev.align_generation = next_align_generation();
+  rs2_stream align_to = RS2_STREAM_COLOR;
+  obs_frame_processor processor;
+  processor.init(options.width, options.height, &dev, options.layout);
+  processor.raw_depth = options.raw_depth;
+  processor.depth_alignment = options.alignment;
+  processor.depth_mapping = options.mapping;
+  processor.tile_pool = &pool;
+  processor.compositing_workers = options.threads;
+  obs_frame_output output;
+  output.rgba.resize(processor.video_width * processor.video_height * 4);
+  output.aligned_depth.reserve((size_t)options.width * options.height);
+
+  for ( int s = 0; s < STAGE_COUNT; s++ ) result.stages.push_back(latency_samples(processing_stage_name(s)));
+  for ( size_t i = 0; i < options.frame_count + WARMUP_FRAMES; i++ )
+  {
+    rs2::frameset frames;
+    if ( !source->next(frames) ) break;
+    uint64_t allocations_before = allocation_count;
+    stopwatch watch;
+    bool ok = processor.update_context(frames, &align_to, output);
+    double us = watch.elapsed_us();
+    uint64_t allocations_after = allocation_count;
+    if ( !ok || i < WARMUP_FRAMES ) continue;
+
+    for ( int s = 0; s < STAGE_COUNT; s++ ) result.stages[s].add(processor.stage_us[s]);
+    result.total.add(us);
+    result.busy_us += us;
+    result.allocations += allocations_after - allocations_before;
+    result.bytes_copied += output.bytes_copied;
+    result.measured++;
+  }
+  delete source;
+}
+
+// Passes frames from capture callback to processing and on to video tick
+// the way the plugin does: through frame_mailbox into a pool_task, which
+// publishes results in a triple buffer like obs_frame_worker, acquired on
+// another thread than the pool's. Statistics are recorded at every step.
+// Counts allocations after warm-up.
+static uint64_t handoff_allocations( thread_pool & pool )
+{
+  const int WARMUP = 30, ROUNDS = 300;
+  synthetic_source source(64, 48);
+  rs2::frameset frames;
+  if ( !source.next(frames) ) return 0;
+  frame_mailbox mailbox;
+  frame_stats stats;
+  triple_buffer<obs_frame_output> output;
+  for ( size_t i = 0; i < output.count; i++ ) output[i].rgba.resize(64 * 48 * 4);
+  double stage_us[STAGE_COUNT] = {};
+  pool_task task(pool, [&]{
+    rs2::frameset f;
+    while ( mailbox.poll(&f) )
+    {
+      int64_t received_ns = stats.frame_dequeued(f.get_frame_number(), stats_now_ns());
+      obs_frame_output & out = output.write_buffer();
+      out.received_ns = received_ns;
+      out.timestamp = f.get_timestamp();
+      stats.frame_processed(stage_us);
+      stats.frame_published();
+      out.published_ns = stats_now_ns();
+      output.publish();
+    }
+  });
+  uint64_t before = 0;
+  size_t shown = 0;
+  for ( int i = 0; i < WARMUP + ROUNDS; i++ )
+  {
+    if ( i == WARMUP ) before = allocation_count;
+    stats.frame_received(frames.get_frame_number() + i, 0, stats_now_ns());
+    mailbox.post(frames);
+    task.schedule();
+    task.wait_idle();
+    int64_t upload_start = stats_now_ns();
+    if ( output.acquire() )
+    {
+      const obs_frame_output & frame = output.read_buffer();
+      stats.frame_shown(frame.received_ns, frame.published_ns, upload_start, stats_now_ns());
+      shown++;
+    }
+  }
+  if ( shown == 0 ) cout << "no frames passed through hand-off\n";
+  return allocation_count - before;
+}
+
+int main( int argc, char **argv )
+{
+  benchmark_options options;
+  bool scaling = false;
+  bool check_allocations = false;
+  for ( int i = 1; i < argc; i++ )
+  {
+    string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if ( arg == "--bag" && has_value ) options.bag = argv[++i];
+    else if ( arg == "--frames" && has_value ) options.frame_count = (size_t)atoi(argv[++i]);
+    else if ( arg == "--size" && has_value && sscanf(argv[++i], "%dx%d", &options.width, &options.height) == 2 ) {}
+    else if ( arg == "--raw-depth" ) options.raw_depth = true;
+    else if ( arg == "--align" && has_value )
+    {
+      string mode = argv[++i];
+      if ( mode == "librealsense" ) options.alignment = DEPTH_ALIGN_LIBREALSENSE;
+      else if ( mode == "cached" ) options.alignment = DEPTH_ALIGN_CACHED;
+    }
+    else if ( arg == "--mapping" && has_value && (options.mapping = atoi(argv[++i])) >= 0 &&
+              options.mapping < DEPTH_MAP_COUNT ) {}
+    else if ( arg == "--layout" && has_value && (options.layout = atoi(argv[++i])) >= 0 &&
+              options.layout < LAYOUT_COUNT ) {}
+    else if ( arg == "--color" && has_value )
+    {
+      string format = argv[++i];
+      if ( format == "yuyv" ) options.color_format = RS2_FORMAT_YUYV;
+      else if ( format != "rgb8" ) { usage(argv[0]); return 1; }
+    }
+    else if ( arg == "--threads" && has_value ) options.threads = (size_t)atoi(argv[++i]);
+    else if ( arg == "--scaling" ) scaling = true;
+    else if ( arg == "--check-allocations" ) check_allocations = true;
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  try
+  {
+    thread_pool pool;
+    if ( scaling )
+    {
+      // composite step with 1 to N compositing threads, speedup relative to one
+      double single_us = 0.0;
+      cout << "threads  composite p50 us  total p50 us       fps  speedup\n";
+      for ( size_t n = 1; n <= pool.size(); n++ )
+      {
+        options.threads = n;
+        benchmark_result result;
+        run_benchmark(options, pool, result);
+        double composite_us = result.stages[STAGE_COMPOSITE].percentile(50);
+        if ( n == 1 ) single_us = composite_us;
+        cout << setw(7) << n << setw(18) << fixed << setprecision(1) << composite_us
+             << setw(14) << result.total.percentile(50) << setw(10) << result.fps()
+             << setw(9) << setprecision(2) << (composite_us > 0.0 ? single_us / composite_us : 0.0) << "\n";
+      }
+      return 0;
+    }
+
+    benchmark_result result;
+    run_benchmark(options, pool, result);
+    cout << "frames " << result.measured << " at " << options.width << "x" << options.height
+         << (options.raw_depth ? ", raw depth" : ", composited")
+         << ", depth mapping " << depth_mapping_name(options.mapping)
+         << ", layout " << output_layout_name(options.layout)
+         << ", color " << rs2_format_to_string(options.color_format)
+         << ", pixel kernels " << get_pixel_kernels().name
+         << ", " << options.threads << " compositing threads\n";
+    latency_samples::print_header(cout);
+    for ( auto & s : result.stages ) s.print(cout);
+    result.total.print(cout);
+    if ( result.measured > 0 )
+    {
+      cout << "throughput " << result.fps() << " fps\n";
+      cout << "allocations per frame " << (double)result.allocations / result.measured << "\n";
+      cout << "bytes copied per frame " << result.bytes_copied / result.measured << "\n";
+      cout << "color bytes per frame from camera "
+           << (size_t)options.width * options.height * (options.color_format == RS2_FORMAT_YUYV ? 2 : 3) << "\n";
+    }
+    if ( check_allocations )
+    {
+      uint64_t handoff = handoff_allocations(pool);
+      cout << "allocations in frame hand-off " << handoff << "\n";
+      if ( result.allocations > 0 || handoff > 0 )
+      {
+        cout << "FAILED: heap allocations in steady state\n";
+        return 2;
+      }
+      cout << "no allocations after warm-up\n";
+    }
+  }
+  catch ( rs2::error & e )
+  {
+    cerr << "RealSense error calling " << e.get_failed_function() << "(" << e.get_failed_args() << "):\n    " << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,240 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+// Streams several cameras at once through device_manager, the way the
+// plugin does with multiple sources, and prints statistics of each camera
+// including timestamp skew between them. Recorded .bag files or software
+// devices stand in for real cameras.
+//
+//   realsense-multi-camera-benchmark [--bag recording.bag ...] [--cameras N]
+//                                    [--skew-ms S] [--seconds T]
+#include <librealsense2/rs.hpp>
+#include <librealsense2/hpp/rs_internal.hpp>
+#include "device_manager.h"
+#include "obs_frame_processor.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// Software device that produces frames at its own rate once started. Each
+// camera gets its timestamps offset by a different amount, to have skew
+// to measure.
+class software_camera
+{
+public:
+  software_camera( const string & serial, const stream_settings & streams, double offset_ms ) :
+    timestamp_offset_ms(offset_ms), settings(streams)
+  {
+    int w = streams.color.width, h = streams.color.height;
+    rs2_intrinsics intrinsics = { w, h, w / 2.0f, h / 2.0f, w * 0.75f, w * 0.75f, RS2_DISTORTION_NONE, { 0, 0, 0, 0, 0 } };
+    depth_sensor = dev.add_sensor("Depth");
+    color_sensor = dev.add_sensor("Color");
+    depth_profile = depth_sensor.add_video_stream({ RS2_STREAM_DEPTH, 0, 0, w, h, streams.depth.fps, 2,
+                                                    RS2_FORMAT_Z16, intrinsics });
+    color_profile = color_sensor.add_video_stream({ RS2_STREAM_COLOR, 0, 1, w, h, streams.color.fps, 3,
+                                                    RS2_FORMAT_RGB8, intrinsics });
+    depth_sensor.add_read_only_option(RS2_OPTION_DEPTH_UNITS, 0.0001f);
+    depth_profile.register_extrinsics_to(color_profile, { { 1, 0, 0, 0, 1, 0, 0, 0, 1 }, { 0.015f, 0, 0 } });
+    dev.register_info(RS2_CAMERA_INFO_SERIAL_NUMBER, serial);
+    dev.create_matcher(RS2_MATCHER_DLR_C);
+    dev.add_to(device_manager::instance().context());
+
+    mt19937 rng(1234);
+    depth.resize((size_t)w * h);
+    color.resize((size_t)w * h * 3);
+    for ( size_t i = 0; i < depth.size(); i++ ) depth[i] = (uint16_t)(5000 + i % w * 40 + rng() % 200);
+    for ( auto & c : color ) c = (uint8_t)rng();
+  }
+  virtual ~software_camera() { stop(); }
+  // device must be started through pipeline before frames are accepted
+  void start()
+  {
+    running = true;
+    feeder = thread(feed, this);
+  }
+  void stop()
+  {
+    if ( !running ) return;
+    running = false;
+    feeder.join();
+  }
+protected:
+  static void feed( software_camera * camera )
+  {
+    chrono::steady_clock::time_point next = chrono::steady_clock::now();
+    chrono::microseconds period(1000000 / camera->settings.color.fps);
+    int frame_number = 1;
+    while ( camera->running )
+    {
+      double now_ms = chrono::duration<double, milli>(chrono::system_clock::now().time_since_epoch()).count();
+      double timestamp = now_ms + camera->timestamp_offset_ms;
+      // pixels never change, frames can point straight at them
+      camera->depth_sensor.on_video_frame({ camera->depth.data(), [](void*){}, camera->settings.depth.width * 2, 2,
+                                            timestamp, RS2_TIMESTAMP_DOMAIN_SYSTEM_TIME, frame_number,
+                                            camera->depth_profile.get() });
+      camera->color_sensor.on_video_frame({ camera->color.data(), [](void*){}, camera->settings.color.width * 3, 3,
+                                            timestamp, RS2_TIMESTAMP_DOMAIN_SYSTEM_TIME, frame_number,
+                                            camera->color_profile.get() });
+      frame_number++;
+      next += period;
+      this_thread::sleep_until(next);
+    }
+  }
+  double timestamp_offset_ms;
+  stream_settings settings;
+  rs2::software_device dev;
+  rs2::software_sensor depth_sensor;
+  rs2::software_sensor color_sensor;
+  rs2::stream_profile depth_profile;
+  rs2::stream_profile color_profile;
+  vector<uint16_t> depth;
+  vector<uint8_t> color;
+  thread feeder;
+  atomic_bool running{ false };
+};
+
+// Processes frames of one camera on the shared pool, like obs_frame_worker
+// but without OBS.
+class camera_consumer
+{
+public:
+  camera_consumer( realsense_device * device ) : dev(device)
+  {
+    auto color = dev->profile.get_stream(RS2_STREAM_COLOR).as<rs2::video_stream_profile>();
+    processor.init(color.width(), color.height(), dev);
+    output.rgba.resize(processor.video_width * processor.video_height * 4);
+    task = new pool_task(device_manager::instance().pool(), [this]{ process_frames(); });
+    dev->set_consumer(task);
+  }
+  virtual ~camera_consumer()
+  {
+    dev->set_consumer(nullptr);
+    delete task;
+  }
+  atomic<uint64_t> frames{ 0 };
+protected:
+  void process_frames()
+  {
+    rs2::frameset frameset;
+    while ( dev->get_frame(frameset) )
+    {
+      int64_t received = dev->stats.frame_dequeued(frameset.get_frame_number(), stats_now_ns());
+      if ( !processor.update_context(frameset, &dev->align_to, output) ) continue;
+      dev->stats.frame_processed(processor.stage_us);
+      dev->stats.frame_published();
+      int64_t now = stats_now_ns();
+      dev->stats.frame_shown(received, now, now, now);
+      frames++;
+    }
+  }
+  realsense_device * dev;
+  obs_frame_processor processor;
+  obs_frame_output output;
+  pool_task * task;
+};
+
+static void usage( const char *name )
+{
+  cerr << "usage: " << name << " [--bag recording.bag ...] [--cameras N] [--skew-ms S] [--seconds T]\n";
+}
+
+int main( int argc, char **argv )
+{
+  vector<string> bags;
+  int synthetic_count = 3;
+  double skew_ms = 2.0;
+  int seconds = 12;
+  for ( int i = 1; i < argc; i++ )
+  {
+    string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if ( arg == "--bag" && has_value ) bags.push_back(argv[++i]);
+    else if ( arg == "--cameras" && has_value ) synthetic_count = atoi(argv[++i]);
+    else if ( arg == "--skew-ms" && has_value ) skew_ms = atof(argv[++i]);
+    else if ( arg == "--seconds" && has_value ) seconds = atoi(argv[++i]);
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  device_manager & manager = device_manager::instance();
+  manager.set_report_function([]( const string & text ) { cout << text << flush; });
+  vector<software_camera *> cameras;
+  vector<realsense_device *> devices;
+  vector<camera_consumer *> consumers;
+  try
+  {
+    if ( bags.empty() )
+    {
+      for ( int i = 0; i < synthetic_count; i++ )
+      {
+        string serial = "software-" + to_string(i);
+        cameras.push_back(new software_camera(serial, stream_settings(), i * skew_ms));
+        devices.push_back(manager.create(serial, stream_settings()));
+      }
+    }
+    else
+    {
+      // recording decides which streams there are, file name stands for serial
+      for ( auto & bag : bags )
+      {
+        realsense_device * dev = manager.create(bag, stream_settings());
+        dev->cfg = rs2::config();
+        dev->cfg.enable_device_from_file(bag, true);
+        devices.push_back(dev);
+      }
+    }
+    for ( auto dev : devices )
+    {
+      dev->start();
+      consumers.push_back(new camera_consumer(dev));
+    }
+    for ( auto camera : cameras ) camera->start();
+
+    cout << devices.size() << " cameras on " << manager.pool().size() << " processing threads\n";
+    this_thread::sleep_for(chrono::seconds(seconds));
+
+    for ( auto camera : cameras ) camera->stop();
+    for ( size_t i = 0; i < devices.size(); i++ )
+    {
+      cout << devices[i]->serial_number << ": " << consumers[i]->frames << " frames processed\n";
+    }
+  }
+  catch ( rs2::error & e )
+  {
+    cerr << "RealSense error calling " << e.get_failed_function() << "(" << e.get_failed_args() << "):\n    " << e.what() << endl;
+  }
+  catch ( exception & e )
+  {
+    cerr << e.what() << endl;
+  }
+  for ( auto consumer : consumers ) delete consumer;
+  for ( auto dev : devices ) manager.release(dev);
+  // devices are stopped on command thread, before their software devices go
+  manager.shutdown();
+  for ( auto camera : cameras ) delete camera;
+  return 0;
+}
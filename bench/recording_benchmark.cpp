@@ -0,0 +1,239 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+// Measures depth compression and frame recording. Reports encode and
+// decode time of rvl codec with its compression ratio, then hands frames
+// to frame_recorder at camera rate and reports how long record() blocks,
+// frames dropped and write rate, and finally reads recording back and
+// checks every depth frame came out as it went in. Frames come from a
+// recorded .bag file, or are generated through rs2::software_device.
+//
+//   realsense-recording-benchmark [--bag recording.bag] [--frames N] [--size WxH]
+//                                 [--color rgb8|yuyv] [--fps F] [--out file]
+//                                 [--write-behind MB]
+//
+// --fps 0 hands frames in as fast as they can be produced.
+#include <librealsense2/rs.hpp>
+#include <librealsense2/hpp/rs_internal.hpp>
+#include "depth_codec.h"
+#include "frame_recorder.h"
+#include "thread_pool.h"
+#include "bench_common.h"
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <thread>
+using namespace std;
+
+// frames point into synthetic buffers, recorder may hold several of them at a time
+static const int SYNTHETIC_BUFFERS = 16;
+
+// Depth ramp in millimetres with holes, and a nearer object crossing the
+// view from one buffer to the next.
+static uint16_t crossing_object_depth( int x, int y, int i, mt19937 & rng, int w, int h )
+{
+  uint16_t d = (uint16_t)(1500 + y * 4 + rng() % 8);
+  int object_x = i * w / SYNTHETIC_BUFFERS;
+  if ( x >= object_x && x < object_x + w / 4 && y > h / 3 ) d = (uint16_t)(800 + rng() % 8);
+  if ( rng() % 50 == 0 ) d = 0;
+  return d;
+}
+
+static void usage( const char *name )
+{
+  cerr << "usage: " << name << " [--bag recording.bag] [--frames N] [--size WxH]\n"
+       << "       [--color rgb8|yuyv] [--fps F] [--out file] [--write-behind MB]\n";
+}
+
+struct benchmark_options
+{
+  string bag;
+  size_t frame_count{ 300 };
+  int width{ 848 };
+  int height{ 480 };
+  rs2_format color_format{ RS2_FORMAT_RGB8 };
+  double fps{ 30.0 };
+  string out{ "recording-benchmark.rsdepth" };
+  size_t write_behind{ frame_recorder::DEFAULT_WRITE_BEHIND_BYTES };
+};
+
+static frame_source * open_source( const benchmark_options & options )
+{
+  if ( !options.bag.empty() ) return new bag_source(options.bag, options.color_format);
+  int w = options.width, h = options.height;
+  return new synthetic_source(w, h, options.color_format, SYNTHETIC_BUFFERS, 0.001f,
+                              [w, h]( int x, int y, int i, mt19937 & rng )
+                              { return crossing_object_depth(x, y, i, rng, w, h); });
+}
+
+static uint64_t depth_hash( const uint16_t *depth, size_t count )
+{
+  uint64_t h = 14695981039346656037ULL;
+  for ( size_t i = 0; i < count; i++ ) h = (h ^ depth[i]) * 1099511628211ULL;
+  return h;
+}
+
+// Compresses and decompresses depth of frames, checking they survive intact.
+static bool codec_benchmark( const benchmark_options & options )
+{
+  frame_source *source = open_source(options);
+  latency_samples encode_us("rvl_encode"), decode_us("rvl_decode");
+  vector<uint8_t> encoded;
+  vector<uint16_t> decoded;
+  uint64_t raw_bytes = 0, compressed_bytes = 0;
+  bool lossless = true;
+  for ( size_t i = 0; i < options.frame_count; i++ )
+  {
+    rs2::frameset frames;
+    if ( !source->next(frames) ) break;
+    rs2::depth_frame depth = frames.get_depth_frame();
+    if ( !depth ) continue;
+    size_t pixels = (size_t)depth.get_width() * depth.get_height();
+    const uint16_t *data = reinterpret_cast<const uint16_t *>(depth.get_data());
+    encoded.resize(rvl_max_encoded_size(pixels));
+    decoded.resize(pixels);
+
+    stopwatch encode_watch;
+    size_t bytes = rvl_encode(data, pixels, encoded.data());
+    encode_us.add(encode_watch.elapsed_us());
+    stopwatch decode_watch;
+    bool ok = rvl_decode(encoded.data(), bytes, decoded.data(), pixels);
+    decode_us.add(decode_watch.elapsed_us());
+    if ( !ok || !equal(decoded.begin(), decoded.end(), data) ) lossless = false;
+    raw_bytes += pixels * sizeof(uint16_t);
+    compressed_bytes += bytes;
+  }
+  delete source;
+
+  latency_samples::print_header(cout);
+  encode_us.print(cout);
+  decode_us.print(cout);
+  double raw_mb = raw_bytes / (1024.0 * 1024.0);
+  cout << fixed << setprecision(1)
+       << "encode " << (encode_us.mean() > 0.0 ? raw_mb / (encode_us.mean() * encode_us.count() * 1e-6) : 0.0)
+       << " MB/s, decode " << (decode_us.mean() > 0.0 ? raw_mb / (decode_us.mean() * decode_us.count() * 1e-6) : 0.0)
+       << " MB/s of raw depth, ratio " << setprecision(2)
+       << (compressed_bytes ? (double)raw_bytes / compressed_bytes : 0.0) << ":1, "
+       << (lossless ? "lossless" : "DEPTH CHANGED IN ROUND TRIP") << "\n";
+  return lossless;
+}
+
+// Records frames handed in at camera rate, then reads them back.
+static bool recorder_benchmark( const benchmark_options & options, thread_pool & pool )
+{
+  frame_source *source = open_source(options);
+  frame_recorder recorder(pool, options.write_behind);
+  recorder.start(options.out);
+  map<uint64_t, uint64_t> hashes;
+  latency_samples record_us("record");
+  auto interval = chrono::duration<double>(options.fps > 0.0 ? 1.0 / options.fps : 0.0);
+  auto next_frame = chrono::steady_clock::now();
+  stopwatch total;
+  for ( size_t i = 0; i < options.frame_count; i++ )
+  {
+    rs2::frameset frames;
+    if ( !source->next(frames) ) break;
+    rs2::depth_frame depth = frames.get_depth_frame();
+    if ( depth )
+      hashes[frames.get_frame_number()] = depth_hash(reinterpret_cast<const uint16_t *>(depth.get_data()),
+                                                     (size_t)depth.get_width() * depth.get_height());
+    stopwatch watch;
+    recorder.record(frames);
+    record_us.add(watch.elapsed_us());
+    next_frame += chrono::duration_cast<chrono::steady_clock::duration>(interval);
+    this_thread::sleep_until(next_frame);
+  }
+  stopwatch stop_watch;
+  recorder.stop();
+  double seconds = total.elapsed_us() * 1e-6;
+  delete source;
+
+  latency_samples::print_header(cout);
+  record_us.print(cout);
+  cout << fixed << setprecision(1) << recorder.frames_recorded() << " frames recorded, "
+       << recorder.frames_dropped() << " dropped, "
+       << recorder.bytes_written() / (1024.0 * 1024.0) / seconds << " MB/s written, stop took "
+       << stop_watch.elapsed_us() / 1000.0 << " ms\n";
+
+  recording_reader reader;
+  if ( !reader.open(options.out) )
+  {
+    cout << options.out << " could not be read back\n";
+    return false;
+  }
+  recording_frame_header header;
+  const uint8_t *color;
+  vector<uint16_t> depth;
+  size_t read = 0, mismatched = 0;
+  stopwatch read_watch;
+  while ( reader.next_frame(header, color, depth) )
+  {
+    read++;
+    auto h = hashes.find(header.frame_number);
+    if ( h == hashes.end() || h->second != depth_hash(depth.data(), depth.size()) ) mismatched++;
+  }
+  cout << read << " frames in " << reader.chunks().size() << " chunks read back in "
+       << read_watch.elapsed_us() / 1000.0 << " ms, " << mismatched << " with depth not as recorded\n";
+  return read == recorder.frames_recorded() && mismatched == 0;
+}
+
+int main( int argc, char **argv )
+{
+  benchmark_options options;
+  for ( int i = 1; i < argc; i++ )
+  {
+    string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if ( arg == "--bag" && has_value ) options.bag = argv[++i];
+    else if ( arg == "--frames" && has_value ) options.frame_count = (size_t)atoi(argv[++i]);
+    else if ( arg == "--size" && has_value && sscanf(argv[++i], "%dx%d", &options.width, &options.height) == 2 ) {}
+    else if ( arg == "--color" && has_value )
+    {
+      string format = argv[++i];
+      if ( format == "yuyv" ) options.color_format = RS2_FORMAT_YUYV;
+      else if ( format != "rgb8" ) { usage(argv[0]); return 1; }
+    }
+    else if ( arg == "--fps" && has_value ) options.fps = atof(argv[++i]);
+    else if ( arg == "--out" && has_value ) options.out = argv[++i];
+    else if ( arg == "--write-behind" && has_value ) options.write_behind = (size_t)atoi(argv[++i]) << 20;
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  try
+  {
+    thread_pool pool;
+    bool ok = codec_benchmark(options);
+    cout << "\n";
+    ok = recorder_benchmark(options, pool) && ok;
+    return ok ? 0 : 2;
+  }
+  catch ( rs2::error & e )
+  {
+    cerr << "RealSense error calling " << e.get_failed_function() << "(" << e.get_failed_args() << "):\n    " << e.what() << "\n";
+  }
+  catch ( exception & e )
+  {
+    cerr << e.what() << "\n";
+  }
+  return 1;
+}
@@ -0,0 +1,62 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "cpu_usage.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+using namespace std;
+
+double current_thread_cpu_seconds()
+{
+#ifdef _WIN32
+  FILETIME creation, exit, kernel, user;
+  if ( !GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user) ) return 0.0;
+  ULARGE_INTEGER k, u;
+  k.LowPart = kernel.dwLowDateTime; k.HighPart = kernel.dwHighDateTime;
+  u.LowPart = user.dwLowDateTime;   u.HighPart = user.dwHighDateTime;
+  // FILETIME is in 100 ns units
+  return (double)(k.QuadPart + u.QuadPart) * 1e-7;
+#else
+  timespec ts;
+  if ( clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0 ) return 0.0;
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+void thread_cpu_meter::reset()
+{
+  window_start = chrono::steady_clock::now();
+  window_start_cpu = current_thread_cpu_seconds();
+  current_load = 0.0f;
+}
+
+void thread_cpu_meter::sample()
+{
+  auto now = chrono::steady_clock::now();
+  double wall = chrono::duration<double>(now - window_start).count();
+  if ( wall < CPU_LOAD_WINDOW_SECONDS ) return;
+  
+  double cpu = current_thread_cpu_seconds();
+  current_load = (float)((cpu - window_start_cpu) / wall);
+  window_start = now;
+  window_start_cpu = cpu;
+}
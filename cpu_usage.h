@@ -0,0 +1,42 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <atomic>
+#include <chrono>
+
+// how often the measured load value is refreshed
+const double CPU_LOAD_WINDOW_SECONDS = 1.0;
+
+// CPU time consumed by the calling thread so far, in seconds.
+double current_thread_cpu_seconds();
+
+// Measures how much of one core a thread consumes. The measured thread
+// calls sample() now and then; any thread may read load().
+class thread_cpu_meter
+{
+public:
+  void reset();
+  void sample();
+  // fraction of one core used during the last window, 0.0 - 1.0
+  float load() const { return current_load; }
+protected:
+  std::chrono::steady_clock::time_point window_start;
+  double window_start_cpu{ 0.0 };
+  std::atomic<float> current_load{ 0.0f };
+};
@@ -0,0 +1,132 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include "depth_aligner.h"
+#include <librealsense2/rsutil.h>
+#include <algorithm>
+#include <cstring>
+using namespace std;
+
+void depth_aligner::align( const rs2::depth_frame & depth, const rs2::depth_frame & original_depth,
+                           const rs2::video_frame & color, std::vector<uint16_t> & output )
+{
+  rs2::video_stream_profile depth_profile = depth.get_profile().as<rs2::video_stream_profile>();
+  rs2::video_stream_profile color_profile = color.get_profile().as<rs2::video_stream_profile>();
+  rs2_intrinsics di = depth_profile.get_intrinsics();
+  rs2_intrinsics ci = color_profile.get_intrinsics();
+  rs2_extrinsics ex = original_depth.get_profile().get_extrinsics_to(color_profile);
+  if ( !valid ||
+       memcmp(&di, &depth_intrin, sizeof(di)) != 0 ||
+       memcmp(&ci, &color_intrin, sizeof(ci)) != 0 ||
+       memcmp(&ex, &extrin, sizeof(ex)) != 0 )
+  {
+    update_mapping( di, ci, ex );
+  }
+
+  output.resize( (size_t)color_intrin.width * color_intrin.height );
+  std::fill( output.begin(), output.end(), 0 );
+
+  const size_t width = depth_intrin.width;
+  const size_t stride = depth.get_stride_in_bytes() / sizeof(uint16_t);
+  const uint16_t *src = reinterpret_cast<const uint16_t *>(depth.get_data());
+  const float units = depth.get_units();
+  for ( int y = 0; y < depth_intrin.height; y++ )
+  {
+    const uint16_t *row = src + y * stride;
+    const float *top = &corner_rays[(y * (width + 1)) * 3];
+    const float *bottom = &corner_rays[((y + 1) * (width + 1)) * 3];
+    for ( size_t x = 0; x < width; x++ )
+    {
+      uint16_t d = row[x];
+      if ( d == 0 ) continue;
+      float z = d * units;
+      // top left and bottom right corners of the pixel in color image
+      int x0, y0, x1, y1;
+      if ( !project( top + x * 3, z, x0, y0 ) ||
+           !project( bottom + (x + 1) * 3, z, x1, y1 ) ) continue;
+      if ( x0 < 0 || y0 < 0 || x1 >= color_intrin.width || y1 >= color_intrin.height ) continue;
+      // nearest surface wins where pixels overlap
+      for ( int cy = y0; cy <= y1; cy++ )
+      {
+        uint16_t *out = output.data() + (size_t)cy * color_intrin.width;
+        for ( int cx = x0; cx <= x1; cx++ )
+        {
+          out[cx] = out[cx] ? std::min(out[cx], d) : d;
+        }
+      }
+    }
+  }
+}
+
+bool depth_aligner::project( const float *ray, float z, int & x, int & y ) const
+{
+  float point[3] = { z * ray[0] + extrin.translation[0],
+                     z * ray[1] + extrin.translation[1],
+                     z * ray[2] + extrin.translation[2] };
+  if ( point[2] <= 0.0f ) return false;
+  float pixel[2];
+  if ( color_distorted )
+  {
+    rs2_project_point_to_pixel( pixel, &color_intrin, point );
+  }
+  else
+  {
+    pixel[0] = point[0] / point[2] * color_intrin.fx + color_intrin.ppx;
+    pixel[1] = point[1] / point[2] * color_intrin.fy + color_intrin.ppy;
+  }
+  // same rounding as librealsense uses
+  x = (int)(pixel[0] + 0.5f);
+  y = (int)(pixel[1] + 0.5f);
+  return true;
+}
+
+void depth_aligner::update_mapping( const rs2_intrinsics & depth, const rs2_intrinsics & color,
+                                    const rs2_extrinsics & depth_to_color )
+{
+  depth_intrin = depth;
+  color_intrin = color;
+  extrin = depth_to_color;
+  color_distorted = false;
+  if ( color.model != RS2_DISTORTION_NONE )
+  {
+    for ( float c : color.coeffs ) if ( c != 0.0f ) color_distorted = true;
+  }
+
+  const size_t width = depth.width + 1;
+  const size_t height = depth.height + 1;
+  corner_rays.resize( width * height * 3 );
+  const float *r = extrin.rotation; // column-major
+  for ( size_t y = 0; y < height; y++ )
+  {
+    for ( size_t x = 0; x < width; x++ )
+    {
+      // corner (x, y) is at pixel coordinate (x - 0.5, y - 0.5)
+      float pixel[2] = { x - 0.5f, y - 0.5f };
+      float ray[3];
+      rs2_deproject_pixel_to_point( ray, &depth_intrin, pixel, 1.0f );
+      float *out = &corner_rays[(y * width + x) * 3];
+      out[0] = r[0] * ray[0] + r[3] * ray[1] + r[6] * ray[2];
+      out[1] = r[1] * ray[0] + r[4] * ray[1] + r[7] * ray[2];
+      out[2] = r[2] * ray[0] + r[5] * ray[1] + r[8] * ray[2];
+    }
+  }
+  valid = true;
+  rebuilds++;
+}
@@ -0,0 +1,52 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <librealsense2/rs.hpp>
+
+// Reprojects depth into color camera's view like rs2::align does, but the
+// per-pixel deprojection rays are computed once and cached. Mapping is
+// only rebuilt when intrinsics or extrinsics of the streams change.
+class depth_aligner
+{
+public:
+  // Writes depth registered to color image into output, which is resized
+  // to color image size. Pixels without depth are zero. original_depth is
+  // the unfiltered depth frame, used for extrinsics between the sensors.
+  void align( const rs2::depth_frame & depth, const rs2::depth_frame & original_depth,
+              const rs2::video_frame & color, std::vector<uint16_t> & output );
+  // how many times mapping has been (re)built
+  size_t rebuild_count() const { return rebuilds; }
+protected:
+  rs2_intrinsics depth_intrin;
+  rs2_intrinsics color_intrin;
+  rs2_extrinsics extrin;
+  bool valid{ false };
+  bool color_distorted{ false };
+  size_t rebuilds{ 0 };
+  // deprojection rays of depth pixel corners, rotated to color camera
+  // orientation. (width+1) * (height+1) corners, three floats each.
+  std::vector<float> corner_rays;
+
+  void update_mapping( const rs2_intrinsics & depth, const rs2_intrinsics & color,
+                       const rs2_extrinsics & depth_to_color );
+  inline bool project( const float *ray, float z, int & x, int & y ) const;
+};
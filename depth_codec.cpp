@@ -0,0 +1,125 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "depth_codec.h"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+// Nibbles are collected into 32-bit words, first nibble in the highest
+// bits. State is kept in locals of the caller so it stays in registers
+// across the byte stores.
+inline void put_vle( uint32_t value, uint32_t & word, int & nibbles, uint8_t *& out )
+{
+  do
+  {
+    uint32_t nibble = value & 0x7;
+    value >>= 3;
+    if ( value ) nibble |= 0x8;
+    word = (word << 4) | nibble;
+    if ( ++nibbles == 8 )
+    {
+      memcpy( out, &word, sizeof(word) );
+      out += sizeof(word);
+      word = 0;
+      nibbles = 0;
+    }
+  } while ( value );
+}
+
+inline bool get_vle( uint32_t & value, uint32_t & word, int & nibbles, const uint8_t *& in, const uint8_t * end )
+{
+  value = 0;
+  for ( int shift = 0; shift < 32; shift += 3 )
+  {
+    if ( nibbles == 0 )
+    {
+      if ( end - in < (ptrdiff_t)sizeof(word) ) return false;
+      memcpy( &word, in, sizeof(word) );
+      in += sizeof(word);
+      nibbles = 8;
+    }
+    uint32_t nibble = word >> 28;
+    word <<= 4;
+    nibbles--;
+    value |= (nibble & 0x7) << shift;
+    if ( (nibble & 0x8) == 0 ) return true;
+  }
+  // longer than any value the encoder writes
+  return false;
+}
+}
+
+size_t rvl_encode( const uint16_t * depth, size_t pixel_count, uint8_t * out )
+{
+  uint8_t * const start = out;
+  uint32_t word = 0;
+  int nibbles = 0;
+  const uint16_t * end = depth + pixel_count;
+  int previous = 0;
+  while ( depth != end )
+  {
+    const uint16_t * run = depth;
+    while ( depth != end && *depth == 0 ) depth++;
+    put_vle( (uint32_t)(depth - run), word, nibbles, out );
+    run = depth;
+    while ( depth != end && *depth != 0 ) depth++;
+    put_vle( (uint32_t)(depth - run), word, nibbles, out );
+    for ( ; run != depth; run++ )
+    {
+      int delta = *run - previous;
+      // zigzag, small deltas of either sign stay small
+      put_vle( ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31), word, nibbles, out );
+      previous = *run;
+    }
+  }
+  if ( nibbles > 0 )
+  {
+    word <<= 4 * (8 - nibbles);
+    memcpy( out, &word, sizeof(word) );
+    out += sizeof(word);
+  }
+  return out - start;
+}
+
+bool rvl_decode( const uint8_t * in, size_t size, uint16_t * depth, size_t pixel_count )
+{
+  const uint8_t * in_end = in + size;
+  uint32_t word = 0;
+  int nibbles = 0;
+  uint16_t * end = depth + pixel_count;
+  int previous = 0;
+  while ( depth != end )
+  {
+    uint32_t zeros, valid;
+    if ( !get_vle( zeros, word, nibbles, in, in_end ) || zeros > (size_t)(end - depth) ) return false;
+    std::fill( depth, depth + zeros, (uint16_t)0 );
+    depth += zeros;
+    if ( !get_vle( valid, word, nibbles, in, in_end ) || valid > (size_t)(end - depth) ) return false;
+    for ( uint32_t i = 0; i < valid; i++ )
+    {
+      uint32_t coded;
+      if ( !get_vle( coded, word, nibbles, in, in_end ) ) return false;
+      int delta = (int)(coded >> 1) ^ -(int)(coded & 1);
+      previous += delta;
+      *depth++ = (uint16_t)previous;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,231 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "depth_export.h"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+using namespace std;
+
+// atomics in shared memory must not hide a lock inside this process
+static_assert( ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+               "depth export needs lock-free 32 and 64-bit atomics" );
+
+static size_t align_up( size_t bytes )
+{
+  return (bytes + 63) & ~(size_t)63;
+}
+
+int64_t depth_export_now_ns()
+{
+  timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+depth_export_writer::~depth_export_writer()
+{
+  close();
+}
+
+bool depth_export_writer::open( const string & name, size_t max_pixels )
+{
+  close();
+  size_t data_offset = align_up( sizeof(depth_export_slot) );
+  size_t slot_bytes = data_offset + align_up( max_pixels * sizeof(uint16_t) );
+  size_t bytes = align_up( sizeof(depth_export_header) ) + slot_bytes * DEPTH_EXPORT_SLOTS;
+
+  // Readers of a region left over keep their mapping of it, a fresh one
+  // is never resized under them.
+  shm_unlink( name.c_str() );
+  int fd = shm_open( name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600 );
+  if ( fd < 0 )
+  {
+    cerr << "Could not create shared memory " << name << ": " << strerror(errno) << "\n";
+    return false;
+  }
+  void * p = MAP_FAILED;
+  if ( ftruncate( fd, (off_t)bytes ) == 0 )
+    p = mmap( nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+  int error = errno;
+  ::close( fd );
+  if ( p == MAP_FAILED )
+  {
+    cerr << "Could not map shared memory " << name << ": " << strerror(error) << "\n";
+    shm_unlink( name.c_str() );
+    return false;
+  }
+  // region is zero filled, so every slot starts at sequence 0
+  header = new (p) depth_export_header();
+  memcpy( header->magic, DEPTH_EXPORT_MAGIC, sizeof(DEPTH_EXPORT_MAGIC) );
+  header->slot_count = DEPTH_EXPORT_SLOTS;
+  header->slot_bytes = slot_bytes;
+  header->slot_data_offset = data_offset;
+  header->latest.store( 0, memory_order_relaxed );
+  uint8_t * slots = reinterpret_cast<uint8_t *>(p) + align_up( sizeof(depth_export_header) );
+  for ( uint32_t s = 0; s < DEPTH_EXPORT_SLOTS; s++ ) new (slots + s * slot_bytes) depth_export_slot();
+  header->state.store( DEPTH_EXPORT_OPEN, memory_order_release );
+
+  region_name = name;
+  region_bytes = bytes;
+  capacity = max_pixels;
+  published = 0;
+  return true;
+}
+
+void depth_export_writer::close()
+{
+  if ( header == nullptr ) return;
+  header->state.store( DEPTH_EXPORT_CLOSED, memory_order_release );
+  munmap( header, region_bytes );
+  shm_unlink( region_name.c_str() );
+  header = nullptr;
+}
+
+void depth_export_writer::publish( const depth_export_info & info, const uint16_t * depth, size_t stride_bytes )
+{
+  if ( header == nullptr || (size_t)info.width * info.height > capacity ) return;
+  uint64_t sequence = ++published;
+  uint8_t * base = reinterpret_cast<uint8_t *>(header) + align_up( sizeof(depth_export_header) ) +
+                   (sequence % DEPTH_EXPORT_SLOTS) * header->slot_bytes;
+  depth_export_slot * slot = reinterpret_cast<depth_export_slot *>(base);
+
+  // odd sequence must be visible before any of the new data
+  slot->sequence.store( sequence * 2 - 1, memory_order_relaxed );
+  atomic_thread_fence( memory_order_release );
+  slot->info = info;
+  slot->info.published_ns = depth_export_now_ns();
+  uint8_t * dst = base + header->slot_data_offset;
+  const uint8_t * src = reinterpret_cast<const uint8_t *>(depth);
+  size_t row_bytes = info.width * sizeof(uint16_t);
+  if ( stride_bytes == row_bytes )
+  {
+    memcpy( dst, src, row_bytes * info.height );
+  }
+  else
+  {
+    for ( uint32_t y = 0; y < info.height; y++ ) memcpy( dst + y * row_bytes, src + y * stride_bytes, row_bytes );
+  }
+  slot->sequence.store( sequence * 2, memory_order_release );
+  header->latest.store( sequence, memory_order_release );
+}
+
+depth_export_reader::~depth_export_reader()
+{
+  close();
+}
+
+bool depth_export_reader::open( const string & name )
+{
+  close();
+  region_name = name;
+  int fd = shm_open( name.c_str(), O_RDONLY, 0 );
+  if ( fd < 0 ) return false;
+  struct stat st;
+  void * p = MAP_FAILED;
+  if ( fstat( fd, &st ) == 0 && (size_t)st.st_size >= sizeof(depth_export_header) )
+    p = mmap( nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+  ::close( fd );
+  if ( p == MAP_FAILED ) return false;
+
+  // rest of header is only written before state becomes open
+  const depth_export_header * h = reinterpret_cast<const depth_export_header *>(p);
+  if ( h->state.load( memory_order_acquire ) != DEPTH_EXPORT_OPEN ||
+       memcmp( h->magic, DEPTH_EXPORT_MAGIC, sizeof(DEPTH_EXPORT_MAGIC) ) != 0 ||
+       h->slot_count == 0 ||
+       align_up( sizeof(depth_export_header) ) + h->slot_bytes * h->slot_count > (uint64_t)st.st_size )
+  {
+    munmap( p, (size_t)st.st_size );
+    return false;
+  }
+  header = h;
+  region_bytes = (size_t)st.st_size;
+  // frames published before opening do not count as missed
+  last_sequence = header->latest.load( memory_order_acquire );
+  if ( last_sequence > 0 ) last_sequence--;
+  return true;
+}
+
+void depth_export_reader::close()
+{
+  if ( header == nullptr ) return;
+  munmap( const_cast<depth_export_header *>(header), region_bytes );
+  header = nullptr;
+}
+
+const depth_export_slot * depth_export_reader::slot( uint64_t sequence ) const
+{
+  const uint8_t * base = reinterpret_cast<const uint8_t *>(header) + align_up( sizeof(depth_export_header) ) +
+                         (sequence % header->slot_count) * header->slot_bytes;
+  return reinterpret_cast<const depth_export_slot *>(base);
+}
+
+bool depth_export_reader::latest( depth_export_view & view )
+{
+  if ( header == nullptr || header->state.load( memory_order_acquire ) != DEPTH_EXPORT_OPEN )
+  {
+    if ( !open( region_name ) ) return false;
+  }
+  // a few tries, writer may lap a slot between reading latest and the slot
+  for ( int attempt = 0; attempt < 4; attempt++ )
+  {
+    uint64_t sequence = header->latest.load( memory_order_acquire );
+    if ( sequence == 0 || sequence == last_sequence ) return false;
+    const depth_export_slot * s = slot( sequence );
+    if ( s->sequence.load( memory_order_acquire ) != sequence * 2 ) continue;
+    view.info = s->info;
+    atomic_thread_fence( memory_order_acquire );
+    if ( s->sequence.load( memory_order_relaxed ) != sequence * 2 ) continue;
+    if ( (size_t)view.info.width * view.info.height * sizeof(uint16_t) >
+         header->slot_bytes - header->slot_data_offset ) return false;
+
+    view.depth = reinterpret_cast<const uint16_t *>(reinterpret_cast<const uint8_t *>(s) + header->slot_data_offset);
+    view.sequence = sequence;
+    if ( last_sequence != 0 && sequence > last_sequence + 1 ) missed += sequence - last_sequence - 1;
+    last_sequence = sequence;
+    return true;
+  }
+  return false;
+}
+
+bool depth_export_reader::wait( depth_export_view & view, unsigned int timeout_ms )
+{
+  int64_t deadline = depth_export_now_ns() + timeout_ms * 1000000LL;
+  while ( !latest( view ) )
+  {
+    if ( depth_export_now_ns() >= deadline ) return false;
+    // writer does not signal readers, that would need it to make a system call per frame
+    this_thread::sleep_for( chrono::microseconds(500) );
+  }
+  return true;
+}
+
+bool depth_export_reader::still_valid( const depth_export_view & view ) const
+{
+  if ( header == nullptr || view.depth == nullptr ) return false;
+  // reads of pixels must complete before sequence is checked again
+  atomic_thread_fence( memory_order_acquire );
+  return slot( view.sequence )->sequence.load( memory_order_relaxed ) == view.sequence * 2;
+}
@@ -0,0 +1,162 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Filtered depth frames published into POSIX shared memory for other
+// processes. Region holds a header and DEPTH_EXPORT_SLOTS slots, each a
+// depth_export_slot followed by Z16 pixels, rows packed without padding.
+// Writer fills slots round robin and never waits for readers. Every slot
+// has a sequence number, odd while a frame is being written into it, so
+// readers use pixels in place and afterwards check that sequence did not
+// change while they did (a seqlock). A frame stays intact until writer
+// comes around to its slot again, DEPTH_EXPORT_SLOTS - 1 frames later.
+//
+// This header does not depend on librealsense, consumers only need it and
+// depth_export.cpp.
+const char DEPTH_EXPORT_MAGIC[8] = { 'R', 'S', 'D', 'E', 'X', 'P', '0', '1' };
+const uint32_t DEPTH_EXPORT_SLOTS = 4;
+// region name is this followed by camera serial number
+const char * const DEPTH_EXPORT_NAME_PREFIX = "/realsense-depth-";
+
+enum depth_export_state
+{
+  DEPTH_EXPORT_INITIALIZING = 0,
+  DEPTH_EXPORT_OPEN,
+  // writer has stopped or moved to a region of another size, readers reopen
+  DEPTH_EXPORT_CLOSED
+};
+
+// same fields as rs2_intrinsics
+struct depth_export_intrinsics
+{
+  int32_t width;
+  int32_t height;
+  float ppx;
+  float ppy;
+  float fx;
+  float fy;
+  // rs2_distortion
+  int32_t model;
+  float coeffs[5];
+};
+
+struct depth_export_info
+{
+  uint64_t frame_number;
+  // device timestamp in milliseconds, and its rs2_timestamp_domain
+  double timestamp;
+  int32_t timestamp_domain;
+  // meters per depth unit
+  float depth_units;
+  // CLOCK_MONOTONIC nanoseconds when frame was published
+  int64_t published_ns;
+  uint32_t width;
+  uint32_t height;
+  depth_export_intrinsics intrinsics;
+};
+
+struct depth_export_slot
+{
+  // 2n - 1 while frame n is written, 2n when it is complete
+  std::atomic<uint64_t> sequence;
+  depth_export_info info;
+};
+
+struct depth_export_header
+{
+  char magic[8];
+  std::atomic<uint32_t> state;
+  uint32_t slot_count;
+  // from start of one slot to the next, pixels start slot_data_offset into slot
+  uint64_t slot_bytes;
+  uint64_t slot_data_offset;
+  // sequence of latest complete frame, 0 before first
+  std::atomic<uint64_t> latest;
+};
+
+// Frame read in place, see depth_export_reader.
+struct depth_export_view
+{
+  depth_export_info info;
+  // width * height pixels in shared memory
+  const uint16_t * depth{ nullptr };
+  uint64_t sequence{ 0 };
+};
+
+// Publishes frames into a region of its own.
+class depth_export_writer
+{
+public:
+  virtual ~depth_export_writer();
+  // Creates region with room for frames of up to max_pixels, replacing one
+  // left over under same name. Returns false if it could not be created.
+  bool open( const std::string & name, size_t max_pixels );
+  // Marks region closed for readers and removes it.
+  void close();
+  bool is_open() const { return header != nullptr; }
+  const std::string & name() const { return region_name; }
+  size_t max_pixels() const { return capacity; }
+  // Copies frame into next slot. depth has info.height rows of info.width
+  // pixels, stride_bytes apart. Frames larger than max_pixels are skipped.
+  void publish( const depth_export_info & info, const uint16_t * depth, size_t stride_bytes );
+  uint64_t frames_published() const { return published; }
+protected:
+  std::string region_name;
+  depth_export_header * header{ nullptr };
+  size_t region_bytes{ 0 };
+  size_t capacity{ 0 };
+  uint64_t published{ 0 };
+};
+
+// Reads frames of a region in another process, without copying them.
+class depth_export_reader
+{
+public:
+  virtual ~depth_export_reader();
+  // Maps region. Returns false if there is none yet.
+  bool open( const std::string & name );
+  void close();
+  bool is_open() const { return header != nullptr; }
+  // Points view at latest frame if it is newer than the one before, and
+  // returns true. Reopens region when writer has replaced it. Pixels are
+  // not copied, use them and then check still_valid. View points into
+  // region only until next call of latest or wait.
+  bool latest( depth_export_view & view );
+  // Like latest, but polls until a new frame arrives or timeout_ms passes.
+  bool wait( depth_export_view & view, unsigned int timeout_ms );
+  // false if writer has started overwriting view's slot, which means
+  // pixels read from it may be torn and should be thrown away.
+  bool still_valid( const depth_export_view & view ) const;
+  // frames published that were never returned by latest
+  uint64_t frames_missed() const { return missed; }
+protected:
+  std::string region_name;
+  const depth_export_header * header{ nullptr };
+  size_t region_bytes{ 0 };
+  uint64_t last_sequence{ 0 };
+  uint64_t missed{ 0 };
+  const depth_export_slot * slot( uint64_t sequence ) const;
+};
+
+// CLOCK_MONOTONIC in nanoseconds, to compare with published_ns
+int64_t depth_export_now_ns();
@@ -0,0 +1,109 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "depth_filters.h"
+#include <algorithm>
+#include <sstream>
+using namespace std;
+
+const depth_filter_desc depth_filters[DEPTH_FILTER_COUNT] = {
+  { STAGE_DECIMATION, "decimation", "Decimation filter", true, false, 1, {
+      { RS2_OPTION_FILTER_MAGNITUDE, "magnitude", "Decimation magnitude", 1, 8, 1, 2 } } },
+  { STAGE_SPATIAL, "spatial", "Spatial filter", true, true, 4, {
+      { RS2_OPTION_FILTER_MAGNITUDE, "magnitude", "Spatial iterations", 1, 5, 1, 2 },
+      { RS2_OPTION_FILTER_SMOOTH_ALPHA, "alpha", "Spatial smooth alpha", 0.25f, 1.0f, 0.05f, 1.0f },
+      { RS2_OPTION_FILTER_SMOOTH_DELTA, "delta", "Spatial smooth delta", 1, 50, 1, 20 },
+      { RS2_OPTION_HOLES_FILL, "holes", "Spatial hole filling", 0, 5, 1, 0 } } },
+  { STAGE_TEMPORAL, "temporal", "Temporal filter", true, true, 3, {
+      { RS2_OPTION_FILTER_SMOOTH_ALPHA, "alpha", "Temporal smooth alpha", 0.0f, 1.0f, 0.05f, 1.0f },
+      { RS2_OPTION_FILTER_SMOOTH_DELTA, "delta", "Temporal smooth delta", 1, 100, 1, 10 },
+      { RS2_OPTION_HOLES_FILL, "persistency", "Temporal persistency", 0, 8, 1, 1 } } },
+  { STAGE_HOLE_FILLING, "hole_filling", "Hole filling filter", true, false, 1, {
+      { RS2_OPTION_HOLES_FILL, "mode", "Hole filling mode", 0, 2, 1, 1 } } }
+};
+
+const depth_filter_desc * find_depth_filter( processing_stage stage )
+{
+  for ( auto & f : depth_filters )
+  {
+    if ( f.stage == stage ) return &f;
+  }
+  return nullptr;
+}
+
+string default_filter_order()
+{
+  string text;
+  for ( auto & f : depth_filters )
+  {
+    if ( !text.empty() ) text += ",";
+    text += f.setting;
+  }
+  return text;
+}
+
+depth_filter_settings::depth_filter_settings() : disparity_domain(true)
+{
+  for ( size_t f = 0; f < DEPTH_FILTER_COUNT; f++ )
+  {
+    order.push_back(f);
+    enabled[f] = depth_filters[f].default_enabled;
+    for ( size_t o = 0; o < MAX_FILTER_OPTIONS; o++ )
+      values[f][o] = o < depth_filters[f].option_count ? depth_filters[f].options[o].default_value : 0.0f;
+  }
+}
+
+void depth_filter_settings::set_order( const string & text )
+{
+  order.clear();
+  stringstream ss(text);
+  string name;
+  while ( getline(ss, name, ',') )
+  {
+    name.erase(remove(name.begin(), name.end(), ' '), name.end());
+    for ( size_t f = 0; f < DEPTH_FILTER_COUNT; f++ )
+    {
+      if ( name == depth_filters[f].setting && find(order.begin(), order.end(), f) == order.end() )
+        order.push_back(f);
+    }
+  }
+  for ( size_t f = 0; f < DEPTH_FILTER_COUNT; f++ )
+  {
+    if ( find(order.begin(), order.end(), f) == order.end() ) order.push_back(f);
+  }
+}
+
+vector<processing_stage> depth_filter_settings::chain() const
+{
+  // disparity transforms go around the first and last enabled filter using disparity
+  size_t first = order.size(), last = order.size();
+  for ( size_t i = 0; i < order.size(); i++ )
+  {
+    if ( !enabled[order[i]] || !depth_filters[order[i]].uses_disparity || !disparity_domain ) continue;
+    if ( first == order.size() ) first = i;
+    last = i;
+  }
+  vector<processing_stage> stages;
+  for ( size_t i = 0; i < order.size(); i++ )
+  {
+    if ( i == first ) stages.push_back(STAGE_DEPTH_TO_DISPARITY);
+    if ( enabled[order[i]] ) stages.push_back(depth_filters[order[i]].stage);
+    if ( i == last ) stages.push_back(STAGE_DISPARITY_TO_DEPTH);
+  }
+  return stages;
+}
@@ -0,0 +1,80 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <string>
+#include <vector>
+#include <librealsense2/rs.hpp>
+#include "obs_frame_processor.h"
+
+const size_t MAX_FILTER_OPTIONS = 4;
+
+// An option of a depth filter, exposed as a property.
+struct filter_option_desc
+{
+  rs2_option option;
+  // property name after filter's setting prefix, and label
+  const char * setting;
+  const char * label;
+  float min;
+  float max;
+  float step;
+  float default_value;
+};
+
+// A depth filter of the chain, one of processing_stage. Disparity
+// transforms are not listed, they wrap filters that work on disparity.
+struct depth_filter_desc
+{
+  processing_stage stage;
+  // settings are named "filter_<setting>" and "filter_<setting>_<option>"
+  const char * setting;
+  const char * label;
+  bool default_enabled;
+  // spatial and temporal filters smooth better in disparity domain
+  bool uses_disparity;
+  size_t option_count;
+  filter_option_desc options[MAX_FILTER_OPTIONS];
+};
+
+const size_t DEPTH_FILTER_COUNT = 4;
+// in default order of the chain
+extern const depth_filter_desc depth_filters[DEPTH_FILTER_COUNT];
+const depth_filter_desc * find_depth_filter( processing_stage stage );
+// settings of all filters in default order, e.g. "decimation,spatial,temporal,hole_filling"
+std::string default_filter_order();
+
+// Which filters run in which order, and their option values.
+struct depth_filter_settings
+{
+  // indexes to depth_filters; filters left out of the list come after
+  // listed ones in default order
+  std::vector<size_t> order;
+  bool enabled[DEPTH_FILTER_COUNT];
+  float values[DEPTH_FILTER_COUNT][MAX_FILTER_OPTIONS];
+  // run spatial and temporal filters on disparity instead of depth
+  bool disparity_domain;
+
+  // defaults of every filter, which match the chain before it was configurable
+  depth_filter_settings();
+  // parses comma separated filter settings, ignoring unknown ones
+  void set_order( const std::string & text );
+  // Stages to run, disparity transforms included. Allocates, so it is
+  // only called when settings change.
+  std::vector<processing_stage> chain() const;
+};
@@ -0,0 +1,123 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "depth_lut.h"
+#include "pixel_kernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+const char * depth_mapping_name( int mapping )
+{
+  switch ( mapping )
+  {
+  case DEPTH_MAP_STEPS:   return "Steps";
+  case DEPTH_MAP_LINEAR:  return "Linear";
+  case DEPTH_MAP_INVERSE: return "Inverse depth";
+  case DEPTH_MAP_LOG:     return "Logarithmic";
+  case DEPTH_MAP_TURBO:   return "Turbo";
+  case DEPTH_MAP_JET:     return "Jet";
+  case DEPTH_MAP_PACKED16: return "16-bit packed in red and green";
+  default:                return "unknown";
+  }
+}
+
+static uint8_t to_byte( double v )
+{
+  return (uint8_t)std::lround( std::min( 1.0, std::max( 0.0, v ) ) * 255.0 );
+}
+
+static uint32_t rgba( uint8_t r, uint8_t g, uint8_t b )
+{
+  uint8_t bytes[4] = { r, g, b, 255 };
+  uint32_t value;
+  memcpy( &value, bytes, sizeof(value) );
+  return value;
+}
+
+// Polynomial fit of Google's Turbo colormap, t in [0,1]
+static uint32_t turbo( double t )
+{
+  double r = 0.13572138 + t*(4.61539260 + t*(-42.66032258 + t*(132.13108234 + t*(-152.94239396 + t*59.28637943))));
+  double g = 0.09140261 + t*(2.19418839 + t*(4.84296658 + t*(-14.18503333 + t*(4.27729857 + t*2.82956604))));
+  double b = 0.10667330 + t*(12.64194608 + t*(-60.58204836 + t*(110.36276771 + t*(-89.90310912 + t*27.34824973))));
+  return rgba( to_byte(r), to_byte(g), to_byte(b) );
+}
+
+static uint32_t jet( double t )
+{
+  return rgba( to_byte( 1.5 - std::fabs(4.0 * t - 3.0) ),
+               to_byte( 1.5 - std::fabs(4.0 * t - 2.0) ),
+               to_byte( 1.5 - std::fabs(4.0 * t - 1.0) ) );
+}
+
+static uint32_t gray( double t )
+{
+  uint8_t level = to_byte( t );
+  return rgba( level, level, level );
+}
+
+depth_lut::depth_lut() : entries( SIZE )
+{
+}
+
+bool depth_lut::update( int mapping, uint16_t clamp_min, uint16_t clamp_max )
+{
+  if ( mapping == current_mapping && clamp_min == current_min && clamp_max == current_max ) return false;
+  current_mapping = mapping;
+  current_min = clamp_min;
+  current_max = clamp_max;
+
+  const uint32_t black = rgba( 0, 0, 0 );
+  // zero depth means no data, it is never mapped to a color
+  const double lo = std::max<uint16_t>( clamp_min, 1 );
+  const double hi = std::max<double>( clamp_max, lo + 1 );
+  for ( size_t depth = 0; depth < SIZE; depth++ )
+  {
+    if ( mapping == DEPTH_MAP_STEPS )
+    {
+      entries[depth] = gray( depth_to_gray_value( (uint16_t)depth, clamp_min ) / 255.0 );
+      continue;
+    }
+    if ( mapping == DEPTH_MAP_PACKED16 )
+    {
+      entries[depth] = depth_pack_value( (uint16_t)depth );
+      continue;
+    }
+    if ( depth == 0 || depth < lo || depth > hi )
+    {
+      entries[depth] = black;
+      continue;
+    }
+    const double d = (double)depth;
+    double t;
+    switch ( mapping )
+    {
+    case DEPTH_MAP_INVERSE: t = (1.0 / lo - 1.0 / d) / (1.0 / lo - 1.0 / hi); break;
+    case DEPTH_MAP_LOG:     t = std::log(d / lo) / std::log(hi / lo); break;
+    default:                t = (d - lo) / (hi - lo); break;
+    }
+    switch ( mapping )
+    {
+    case DEPTH_MAP_TURBO: entries[depth] = turbo( t ); break;
+    case DEPTH_MAP_JET:   entries[depth] = jet( t ); break;
+    default:              entries[depth] = gray( t ); break;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,65 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// How depth values are turned into output pixels.
+enum depth_mapping
+{
+  // gray level per DEPTH_GRAY_STEP units above clamp min, as always
+  DEPTH_MAP_STEPS = 0,
+  // gray from black at clamp min to white at clamp max
+  DEPTH_MAP_LINEAR,
+  // gray linear in 1/depth, more levels for near objects
+  DEPTH_MAP_INVERSE,
+  // gray linear in log(depth)
+  DEPTH_MAP_LOG,
+  // colormaps over [clamp min, clamp max]
+  DEPTH_MAP_TURBO,
+  DEPTH_MAP_JET,
+  // all 16 bits of depth, high byte in red and low byte in green, not clamped
+  DEPTH_MAP_PACKED16,
+  DEPTH_MAP_COUNT
+};
+const char * depth_mapping_name( int mapping );
+
+// RGBA pixel for every possible 16-bit depth value, so any mapping costs
+// one load per pixel. Table is rebuilt only when its parameters change.
+// Depth units are not a parameter: depth and clamp values are both in
+// the same raw units, so the mapping does not depend on their scale.
+// Not thread safe, each thread that maps depth owns its table.
+class depth_lut
+{
+public:
+  static const size_t SIZE = 65536;
+  depth_lut();
+  // Rebuilds table if any parameter differs from the previous call, returns
+  // true if it did. Table is allocated up front, so this never allocates.
+  bool update( int mapping, uint16_t clamp_min, uint16_t clamp_max );
+  // RGBA pixels in memory order, indexed by depth value
+  const uint32_t * table() const { return entries.data(); }
+  int mapping() const { return current_mapping; }
+protected:
+  std::vector<uint32_t> entries;
+  int current_mapping{ -1 };
+  uint16_t current_min{ 0 };
+  uint16_t current_max{ 0 };
+};
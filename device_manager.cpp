@@ -0,0 +1,440 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "device_manager.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+using namespace std;
+
+device_manager & device_manager::instance()
+{
+  static device_manager manager;
+  return manager;
+}
+
+device_manager::~device_manager()
+{
+  shutdown();
+}
+
+thread_pool & device_manager::pool()
+{
+  lock_guard<mutex> lock(devices_mutex);
+  if ( processing_pool == nullptr ) processing_pool = new thread_pool();
+  return *processing_pool;
+}
+
+vector<stream_mode> camera_info::modes( rs2_stream stream, rs2_format format ) const
+{
+  vector<stream_mode> result;
+  for ( auto & mode : stream == RS2_STREAM_COLOR ? color_modes : depth_modes )
+  {
+    if ( mode.format == format ) result.push_back(mode);
+  }
+  return result;
+}
+
+bool camera_info::supports( rs2_stream stream, const stream_mode & mode ) const
+{
+  const vector<stream_mode> & list = stream == RS2_STREAM_COLOR ? color_modes : depth_modes;
+  return find(list.begin(), list.end(), mode) != list.end();
+}
+
+void device_manager::watch_cameras()
+{
+  {
+    lock_guard<mutex> lock(devices_mutex);
+    if ( watching_cameras ) return;
+    watching_cameras = true;
+    enqueue(COMMAND_ENUMERATE, nullptr);
+  }
+  // callback comes on a librealsense thread, enumeration is left to command thread
+  ctx.set_devices_changed_callback( [this]( rs2::event_information & ) {
+    lock_guard<mutex> lock(devices_mutex);
+    if ( watching_cameras && !is_queued(COMMAND_ENUMERATE, nullptr) ) enqueue(COMMAND_ENUMERATE, nullptr);
+  });
+}
+
+vector<camera_info> device_manager::cameras()
+{
+  watch_cameras();
+  lock_guard<mutex> lock(devices_mutex);
+  return camera_registry;
+}
+
+bool device_manager::find_camera( const string & serial, camera_info & camera )
+{
+  for ( auto & c : cameras() )
+  {
+    if ( c.serial != serial ) continue;
+    camera = c;
+    return true;
+  }
+  return false;
+}
+
+realsense_device * device_manager::create( const string & serial, const stream_settings & streams )
+{
+  lock_guard<mutex> lock(devices_mutex);
+  for ( auto dev : devices )
+  {
+    if ( dev->serial_number == serial )
+    {
+      throw runtime_error("camera " + serial + " is already used by another source");
+    }
+  }
+  realsense_device * dev = new realsense_device(serial, streams, ctx);
+  devices.push_back(dev);
+  if ( monitor_thread == nullptr ) monitor_thread = new thread(monitor, this);
+  return dev;
+}
+
+void device_manager::start( realsense_device * dev )
+{
+  lock_guard<mutex> lock(devices_mutex);
+  dev->requested_config = dev->current_config();
+  dev->requested_version++;
+  enqueue(COMMAND_START, dev);
+}
+
+void device_manager::configure( realsense_device * dev )
+{
+  if ( dev == nullptr ) return;
+  lock_guard<mutex> lock(devices_mutex);
+  device_config config = dev->current_config();
+  if ( config == dev->requested_config ) return;
+  dev->requested_config = config;
+  dev->requested_version++;
+  // queued command writes whatever is requested when it runs
+  if ( is_queued(COMMAND_CONFIGURE, dev) || is_queued(COMMAND_START, dev) ) return;
+  enqueue(COMMAND_CONFIGURE, dev);
+}
+
+string device_manager::configuration_status( realsense_device * dev )
+{
+  if ( dev == nullptr ) return string();
+  lock_guard<mutex> lock(devices_mutex);
+  stringstream ss;
+  ss << "Camera configuration ";
+  if ( !dev->config_error.empty() ) ss << "failed: " << dev->config_error;
+  else if ( dev->applied_version == dev->requested_version ) ss << "applied";
+  else ss << "pending, request " << dev->requested_version << " of which "
+          << dev->applied_version << " applied";
+  if ( dev->stopped_for_idle ) ss << ", stopped while not shown";
+  return ss.str();
+}
+
+void device_manager::release( realsense_device * dev )
+{
+  if ( dev == nullptr ) return;
+  lock_guard<mutex> lock(devices_mutex);
+  devices.remove(dev);
+  // nothing else needs to be done to a device about to be deleted
+  for ( auto c = commands.begin(); c != commands.end(); )
+  {
+    if ( c->dev == dev ) c = commands.erase(c);
+    else                 ++c;
+  }
+  enqueue(COMMAND_RELEASE, dev);
+}
+
+void device_manager::enqueue( command_type type, realsense_device * dev )
+{
+  command c = { type, dev };
+  commands.push_back(c);
+  if ( command_thread == nullptr ) command_thread = new thread(run_commands, this);
+  commands_queued.notify_one();
+}
+
+bool device_manager::is_queued( command_type type, realsense_device * dev ) const
+{
+  for ( auto & c : commands )
+  {
+    if ( c.type == type && c.dev == dev ) return true;
+  }
+  return false;
+}
+
+static bool has_camera( const vector<camera_info> & cameras, const string & serial )
+{
+  for ( auto & c : cameras )
+  {
+    if ( c.serial == serial ) return true;
+  }
+  return false;
+}
+
+// Lists cameras with devices_mutex unlocked, which takes a while since
+// every sensor is asked for its stream profiles.
+void device_manager::enumerate( unique_lock<mutex> & lock )
+{
+  lock.unlock();
+  vector<camera_info> found;
+  int64_t start_ns = stats_now_ns();
+  try
+  {
+    for ( auto && dev : ctx.query_devices() )
+    {
+      if ( !dev.supports(RS2_CAMERA_INFO_SERIAL_NUMBER) ||
+           dev.get_info(RS2_CAMERA_INFO_NAME) == string("Platform Camera") ) continue;
+      camera_info camera;
+      camera.name = dev.get_info(RS2_CAMERA_INFO_NAME);
+      camera.serial = dev.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER);
+      for ( rs2_format format : { RS2_FORMAT_RGB8, RS2_FORMAT_RGBA8, RS2_FORMAT_YUYV } )
+      {
+        vector<stream_mode> modes = supported_stream_modes(dev, RS2_STREAM_COLOR, format);
+        camera.color_modes.insert(camera.color_modes.end(), modes.begin(), modes.end());
+      }
+      camera.depth_modes = supported_stream_modes(dev, RS2_STREAM_DEPTH, RS2_FORMAT_Z16);
+      found.push_back(camera);
+    }
+  }
+  catch ( rs2::error & e )
+  {
+    // camera removed while being asked, another enumeration follows
+    cerr << "RealSense error calling " << e.get_failed_function() << "(" << e.get_failed_args() << "):\n    " << e.what() << endl;
+    lock.lock();
+    return;
+  }
+  cerr << "Found " << found.size() << " RealSense cameras in "
+       << (stats_now_ns() - start_ns) / 1000000 << " ms\n";
+  lock.lock();
+  for ( auto dev : devices )
+  {
+    bool present = has_camera(found, dev->serial_number);
+    if ( !present && has_camera(camera_registry, dev->serial_number) )
+    {
+      cerr << "Realsense " << dev->serial_number << " disconnected\n";
+      dev->disconnected = true;
+    }
+    else if ( present && (dev->disconnected || dev->start_failed) )
+    {
+      dev->disconnected = false;
+      dev->start_failed = false;
+      // idle restart will start it anyway
+      if ( !dev->stopped_for_idle && !is_queued(COMMAND_RECONNECT, dev) && !is_queued(COMMAND_START, dev) )
+        enqueue(COMMAND_RECONNECT, dev);
+    }
+  }
+  camera_registry.swap(found);
+}
+
+// Runs command with devices_mutex unlocked. Only this thread deletes
+// devices, and release() drops commands of a device before queuing its
+// deletion, so device stays valid meanwhile.
+void device_manager::execute( const command & c, unique_lock<mutex> & lock )
+{
+  if ( c.type == COMMAND_ENUMERATE )
+  {
+    enumerate(lock);
+    return;
+  }
+  realsense_device * dev = c.dev;
+  device_config config = dev->requested_config;
+  uint64_t version = dev->requested_version;
+  lock.unlock();
+  string error;
+  int64_t start_ns = stats_now_ns();
+  try
+  {
+    switch ( c.type )
+    {
+    case COMMAND_START:
+    case COMMAND_IDLE_RESTART:
+      dev->start();
+      dev->set_limits(config);
+      break;
+    case COMMAND_RECONNECT:
+      try
+      {
+        dev->stop();
+      }
+      catch ( rs2::error & )
+      {
+        // pipeline of an unplugged camera may fail to stop, starting again is what matters
+      }
+      dev->start();
+      dev->set_limits(config);
+      break;
+    case COMMAND_CONFIGURE:
+      dev->set_limits(config);
+      break;
+    case COMMAND_IDLE_STOP:
+      cerr << "Realsense " << dev->serial_number << " not shown, stopping\n";
+      dev->stop();
+      break;
+    case COMMAND_RELEASE:
+      dev->stop();
+      break;
+    case COMMAND_ENUMERATE:
+      break;
+    }
+  }
+  catch ( rs2::error & e )
+  {
+    error = string(e.get_failed_function()) + ": " + e.what();
+  }
+  catch ( exception & e )
+  {
+    error = e.what();
+  }
+  int64_t ms = (stats_now_ns() - start_ns) / 1000000;
+  if ( !error.empty() ) cerr << "Realsense " << dev->serial_number << " failed: " << error << endl;
+  if ( c.type == COMMAND_RELEASE ) delete dev;
+  lock.lock();
+  if ( c.type == COMMAND_RELEASE || c.type == COMMAND_IDLE_STOP ) return;
+  if ( !error.empty() )
+  {
+    dev->config_error = error;
+    dev->restart_requested_ns = 0;
+    if ( c.type != COMMAND_CONFIGURE ) dev->start_failed = true;
+    return;
+  }
+  if ( c.type != COMMAND_CONFIGURE ) dev->start_failed = false;
+  const char * done = c.type == COMMAND_CONFIGURE ? " configured" :
+                      c.type == COMMAND_RECONNECT ? " reconnected" : " started";
+  cerr << "Realsense " << dev->serial_number << done << " in " << ms << " ms\n";
+  dev->config_error.clear();
+  dev->applied_config = config;
+  dev->applied_version = version;
+}
+
+void device_manager::run_commands( device_manager * manager )
+{
+  unique_lock<mutex> lock(manager->devices_mutex);
+  for (;;)
+  {
+    manager->commands_queued.wait(lock, [manager]{ return manager->stopping || !manager->commands.empty(); });
+    if ( manager->commands.empty() ) break;
+    command c = manager->commands.front();
+    manager->commands.pop_front();
+    manager->execute(c, lock);
+  }
+}
+
+void device_manager::set_idle( realsense_device * dev, bool idle )
+{
+  if ( dev == nullptr ) return;
+  {
+    lock_guard<mutex> lock(devices_mutex);
+    if ( dev->idle == idle ) return;
+    dev->idle = idle;
+    if ( idle ) dev->idle_since_ns = stats_now_ns();
+    else if ( dev->stopped_for_idle )
+    {
+      dev->stopped_for_idle = false;
+      dev->restart_requested_ns = stats_now_ns();
+      enqueue(COMMAND_IDLE_RESTART, dev);
+    }
+  }
+}
+
+// Called with devices_mutex held.
+void device_manager::apply_idle_policy( realsense_device * dev, int64_t now_ns )
+{
+  if ( dev->idle && !dev->stopped_for_idle && dev->idle_policy == IDLE_STOP_STREAMING &&
+       dev->started && now_ns - dev->idle_since_ns >= dev->idle_grace_ns )
+  {
+    dev->stopped_for_idle = true;
+    enqueue(COMMAND_IDLE_STOP, dev);
+  }
+}
+
+void device_manager::set_report_function( const function<void(const string &)> & report )
+{
+  lock_guard<mutex> lock(devices_mutex);
+  report_function = report;
+}
+
+void device_manager::shutdown()
+{
+  {
+    lock_guard<mutex> lock(devices_mutex);
+    stopping = true;
+    // cameras are enumerated again if plugin is used after shutdown
+    watching_cameras = false;
+  }
+  monitor_wakeup.notify_all();
+  commands_queued.notify_all();
+  if ( monitor_thread != nullptr )
+  {
+    monitor_thread->join();
+    delete monitor_thread;
+    monitor_thread = nullptr;
+  }
+  if ( command_thread != nullptr )
+  {
+    command_thread->join();
+    delete command_thread;
+    command_thread = nullptr;
+  }
+  delete processing_pool;
+  processing_pool = nullptr;
+  {
+    // hot-plug callback on ctx may still be enqueuing, it reads this under lock
+    lock_guard<mutex> lock(devices_mutex);
+    stopping = false;
+  }
+}
+
+// Compares newest timestamp of each camera with the first one. Newest
+// framesets of two cameras may be a frame apart when sampled, so skew is
+// taken relative to the nearest frame, which is right as long as cameras
+// are less than half a frame apart.
+void device_manager::sample_skew()
+{
+  if ( devices.size() < 2 ) return;
+  realsense_device * reference = devices.front();
+  double reference_timestamp = reference->latest_timestamp;
+  int domain = reference->latest_timestamp_domain;
+  // hardware clocks of separate cameras are not related to each other
+  if ( reference_timestamp == 0.0 || domain == RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK ) return;
+  for ( auto dev : devices )
+  {
+    double timestamp = dev->latest_timestamp;
+    if ( dev == reference || timestamp == 0.0 || dev->latest_timestamp_domain != domain ) continue;
+    double period = 1000.0 / dev->streams.color.fps;
+    double skew = timestamp - reference_timestamp;
+    skew -= period * floor(skew / period + 0.5);
+    dev->stats.record_us(frame_stats::LATENCY_SKEW, fabs(skew) * 1000.0);
+  }
+}
+
+void device_manager::monitor( device_manager * manager )
+{
+  unique_lock<mutex> lock(manager->devices_mutex);
+  while ( !manager->stopping )
+  {
+    manager->monitor_wakeup.wait_for(lock, chrono::milliseconds(SKEW_SAMPLE_INTERVAL_MS));
+    if ( manager->stopping ) break;
+    manager->sample_skew();
+    int64_t now = stats_now_ns();
+    for ( auto dev : manager->devices )
+    {
+      manager->apply_idle_policy(dev, now);
+      if ( !dev->stats.report_due(now) ) continue;
+      const char * policy = dev->queue_policy == FRAME_QUEUE_FIFO ? " (queued)" : " (newest only)";
+      string text = dev->stats.report(dev->serial_number + policy);
+      if ( manager->report_function ) manager->report_function(text);
+      else                            cerr << text;
+    }
+  }
+}
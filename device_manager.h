@@ -0,0 +1,140 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <librealsense2/rs.hpp>
+#include "realsense-device.h"
+#include "thread_pool.h"
+
+// how often timestamps of cameras are compared
+const unsigned int SKEW_SAMPLE_INTERVAL_MS = 100;
+
+// A connected camera and the stream modes it offers, as last enumerated.
+struct camera_info
+{
+  std::string name;
+  std::string serial;
+  // largest first, in every format the plugin can use
+  std::vector<stream_mode> color_modes;
+  std::vector<stream_mode> depth_modes;
+  // modes of given stream in given format
+  std::vector<stream_mode> modes( rs2_stream stream, rs2_format format ) const;
+  bool supports( rs2_stream stream, const stream_mode & mode ) const;
+};
+
+// Plugin-wide owner of every camera being streamed. Sources get their
+// devices from here, frames of all cameras are processed on one shared
+// thread pool, and a monitor thread compares camera timestamps, writes
+// periodic statistics of each camera to log, and stops cameras of hidden
+// sources. It also keeps a registry of connected cameras, refreshed in the
+// background whenever librealsense reports cameras being plugged in or
+// removed. Everything that talks to a camera over USB - starting,
+// stopping and writing options - runs in order on a command thread, so
+// OBS UI and video threads never wait for a camera.
+class device_manager
+{
+public:
+  static device_manager & instance();
+  virtual ~device_manager();
+
+  // Context used for finding cameras; software devices added to it can
+  // stand in for real ones.
+  rs2::context & context() { return ctx; }
+  thread_pool & pool();
+  // Starts enumerating cameras in background and following hot-plug events.
+  void watch_cameras();
+  // Cameras found by the latest enumeration, empty until it has finished.
+  // Never blocks on USB.
+  std::vector<camera_info> cameras();
+  bool find_camera( const std::string & serial, camera_info & camera );
+  // Returns a new device for camera, not started yet so it can be
+  // configured. Throws runtime_error if camera is already in use.
+  realsense_device * create( const std::string & serial, const stream_settings & streams );
+  // Starts streaming and writes current_config() of device to camera.
+  void start( realsense_device * dev );
+  // Writes current_config() of device to camera. Requests made before the
+  // previous one was applied are coalesced, only the latest one is written.
+  void configure( realsense_device * dev );
+  // One-line state of requested versus applied configuration.
+  std::string configuration_status( realsense_device * dev );
+  // Stops and deletes device returned by create(). Device must not be
+  // used after this, but it is stopped and deleted later.
+  void release( realsense_device * dev );
+  // Source of device was hidden or shown. Devices with IDLE_STOP_STREAMING
+  // are stopped after their grace period and restarted on command thread.
+  void set_idle( realsense_device * dev, bool idle );
+  // Where statistics reports go, standard error by default.
+  void set_report_function( const std::function<void(const std::string &)> & report );
+  // Runs commands still queued, then stops monitoring, command and pool
+  // threads. All devices must be released.
+  void shutdown();
+protected:
+  device_manager() {}
+  void sample_skew();
+  void apply_idle_policy( realsense_device * dev, int64_t now_ns );
+  static void monitor( device_manager * manager );
+
+  enum command_type
+  {
+    COMMAND_START,
+    COMMAND_CONFIGURE,
+    COMMAND_IDLE_STOP,
+    COMMAND_IDLE_RESTART,
+    COMMAND_RELEASE,
+    // list cameras, and reconnect devices whose camera reappeared
+    COMMAND_ENUMERATE,
+    // restart pipeline of device whose camera was unplugged, or missing when
+    // it was started, and is now found
+    COMMAND_RECONNECT
+  };
+  struct command
+  {
+    command_type type;
+    realsense_device * dev;
+  };
+  // called with devices_mutex held
+  void enqueue( command_type type, realsense_device * dev );
+  void execute( const command & c, std::unique_lock<std::mutex> & lock );
+  static void run_commands( device_manager * manager );
+  void enumerate( std::unique_lock<std::mutex> & lock );
+  bool is_queued( command_type type, realsense_device * dev ) const;
+
+  rs2::context ctx;
+  std::mutex devices_mutex;
+  // in creation order, first one is the reference for timestamp skew
+  std::list<realsense_device *> devices;
+  thread_pool * processing_pool {nullptr};
+  std::thread * monitor_thread {nullptr};
+  std::deque<command> commands;
+  std::thread * command_thread {nullptr};
+  std::condition_variable commands_queued;
+  std::vector<camera_info> camera_registry;
+  bool watching_cameras {false};
+  bool stopping {false};
+  // wakes monitor thread for shutdown or for restarting a device
+  std::condition_variable monitor_wakeup;
+  std::function<void(const std::string &)> report_function;
+};
@@ -0,0 +1,92 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <librealsense2/rs.hpp>
+
+// Single-slot frame hand-off where newest frame always wins. Posting
+// replaces whatever the consumer has not taken yet, so consumer never
+// sees a stale frame and never falls behind the camera. The slot is an
+// atomic exchange of frame references; the mutex is only there to let
+// an idle consumer sleep, and post touches it only while one is waiting.
+class frame_mailbox
+{
+public:
+  virtual ~frame_mailbox()
+  {
+    release( slot.exchange(nullptr) );
+  }
+  // Returns true if a frame that was never taken got replaced.
+  bool post( const rs2::frame & frame )
+  {
+    rs2_error *e = nullptr;
+    rs2_frame_add_ref( frame.get(), &e );
+    rs2::error::handle( e );
+    rs2_frame *previous = slot.exchange( frame.get() );
+    release( previous );
+    // Both sequentially consistent: a waiter counted after this load checks
+    // slot after the exchange above, and sees the frame without being woken.
+    if ( waiters.load() > 0 )
+    {
+      // empty critical section orders the post with a consumer about to wait
+      {
+        std::lock_guard<std::mutex> lock(wait_mutex);
+      }
+      frame_posted.notify_one();
+    }
+    return previous != nullptr;
+  }
+  // Takes newest frame if there is one, without blocking.
+  template <class T>
+  bool poll( T * frame )
+  {
+    rs2_frame *f = slot.exchange(nullptr);
+    if ( f == nullptr ) return false;
+    // rs2::frame takes over the reference added in post()
+    *frame = T(rs2::frame(f));
+    return true;
+  }
+  // Like poll, but waits at most timeout_ms for a frame to be posted.
+  template <class T>
+  bool try_wait( T * frame, unsigned int timeout_ms )
+  {
+    if ( poll(frame) ) return true;
+    std::unique_lock<std::mutex> lock(wait_mutex);
+    // counted before slot is checked, see post
+    waiters++;
+    frame_posted.wait_for( lock, std::chrono::milliseconds(timeout_ms),
+                           [this]{ return slot.load() != nullptr; } );
+    waiters--;
+    lock.unlock();
+    return poll(frame);
+  }
+protected:
+  static void release( rs2_frame * f )
+  {
+    if ( f != nullptr ) rs2_release_frame(f);
+  }
+  std::atomic<rs2_frame*> slot{ nullptr };
+  std::mutex wait_mutex;
+  std::condition_variable frame_posted;
+  // consumers in try_wait, post skips mutex and notify when there are none
+  std::atomic<int> waiters{ 0 };
+};
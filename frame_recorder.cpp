@@ -0,0 +1,373 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "frame_recorder.h"
+#include "depth_codec.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+using namespace std;
+
+static bool seek_to( FILE * f, uint64_t offset )
+{
+#ifdef _WIN32
+  return _fseeki64( f, (__int64)offset, SEEK_SET ) == 0;
+#else
+  return fseeko( f, (off_t)offset, SEEK_SET ) == 0;
+#endif
+}
+
+static uint64_t file_size( FILE * f )
+{
+#ifdef _WIN32
+  if ( _fseeki64( f, 0, SEEK_END ) != 0 ) return 0;
+  return (uint64_t)_ftelli64( f );
+#else
+  if ( fseeko( f, 0, SEEK_END ) != 0 ) return 0;
+  return (uint64_t)ftello( f );
+#endif
+}
+
+frame_recorder::frame_recorder( thread_pool & pool, size_t write_behind_bytes ) :
+  pool(pool), write_behind_limit(write_behind_bytes)
+{
+}
+
+frame_recorder::~frame_recorder()
+{
+  stop();
+}
+
+void frame_recorder::start( const string & path )
+{
+  stop();
+  file = fopen( path.c_str(), "wb" );
+  if ( file == nullptr ) throw runtime_error( "could not create recording " + path );
+  if ( fwrite( RECORDING_MAGIC, sizeof(RECORDING_MAGIC), 1, file ) != 1 )
+  {
+    fclose( file );
+    file = nullptr;
+    throw runtime_error( "could not write recording " + path );
+  }
+  file_offset = sizeof(RECORDING_MAGIC);
+  file_path = path;
+  index.clear();
+  chunk.clear();
+  chunk_frames = 0;
+  writer_stopping = false;
+  write_failed = false;
+  recorded = dropped = written = 0;
+  depth_raw_bytes = depth_compressed_bytes = 0;
+  writer = thread( &frame_recorder::write_chunks, this );
+  encoder = new pool_task( pool, [this]{ encode_queued(); } );
+  {
+    lock_guard<mutex> lock(queue_mutex);
+    accepting = true;
+  }
+  cerr << "Recording to " << path << "\n";
+}
+
+void frame_recorder::stop()
+{
+  if ( encoder == nullptr ) return;
+  {
+    // record() checks this under same lock, so nothing is scheduled after
+    lock_guard<mutex> lock(queue_mutex);
+    accepting = false;
+  }
+  // encoder runs until queue is empty
+  delete encoder;
+  encoder = nullptr;
+  finish_chunk();
+  {
+    lock_guard<mutex> lock(write_mutex);
+    writer_stopping = true;
+  }
+  chunk_ready.notify_one();
+  writer.join();
+  fclose( file );
+  file = nullptr;
+  cerr << status() << "\n";
+}
+
+bool frame_recorder::record( const rs2::frameset & frames )
+{
+  {
+    lock_guard<mutex> lock(queue_mutex);
+    if ( !accepting ) return false;
+    if ( queue_count == QUEUE_FRAMES )
+    {
+      dropped++;
+      return false;
+    }
+    queue[(queue_first + queue_count) % QUEUE_FRAMES] = frames;
+    queue_count++;
+    encoder->schedule();
+  }
+  return true;
+}
+
+void frame_recorder::encode_queued()
+{
+  rs2::frameset frames;
+  for ( ;; )
+  {
+    {
+      lock_guard<mutex> lock(queue_mutex);
+      if ( queue_count == 0 ) return;
+      frames = queue[queue_first];
+      queue[queue_first] = rs2::frameset();
+      queue_first = (queue_first + 1) % QUEUE_FRAMES;
+      queue_count--;
+    }
+    encode( frames );
+  }
+}
+
+void frame_recorder::encode( const rs2::frameset & frames )
+{
+  rs2::depth_frame depth = frames.get_depth_frame();
+  rs2::video_frame color = frames.get_color_frame();
+  if ( !depth )
+  {
+    dropped++;
+    return;
+  }
+  const size_t depth_pixels = (size_t)depth.get_width() * depth.get_height();
+  const size_t color_bytes = color ? (size_t)color.get_data_size() : 0;
+  // worst case size, so that the buffer never grows past its limit
+  const size_t record_bytes = sizeof(recording_frame_header) + color_bytes + rvl_max_encoded_size( depth_pixels );
+  // chunk being filled counts against the limit too, keep it to a fraction
+  if ( chunk_frames > 0 && chunk.size() + record_bytes > write_behind_limit / 4 ) finish_chunk();
+  {
+    lock_guard<mutex> lock(write_mutex);
+    if ( write_behind + chunk.size() + record_bytes > write_behind_limit )
+    {
+      dropped++;
+      return;
+    }
+  }
+  if ( encoded_depth.size() < rvl_max_encoded_size( depth_pixels ) )
+    encoded_depth.resize( rvl_max_encoded_size( depth_pixels ) );
+  // Z16 rows have no padding, so the frame is one run of pixels
+  size_t depth_bytes = rvl_encode( reinterpret_cast<const uint16_t *>(depth.get_data()), depth_pixels,
+                                   encoded_depth.data() );
+
+  recording_frame_header header = {};
+  header.frame_number = frames.get_frame_number();
+  header.timestamp    = frames.get_timestamp();
+  header.depth_width  = (uint16_t)depth.get_width();
+  header.depth_height = (uint16_t)depth.get_height();
+  header.depth_bytes  = (uint32_t)depth_bytes;
+  header.depth_units  = depth.get_units();
+  if ( color )
+  {
+    header.color_format = (uint32_t)color.get_profile().format();
+    header.color_width  = (uint16_t)color.get_width();
+    header.color_height = (uint16_t)color.get_height();
+    header.color_bytes  = (uint32_t)color_bytes;
+  }
+  if ( chunk_frames == 0 )
+  {
+    // header is filled in when chunk is finished
+    chunk.resize( sizeof(recording_chunk_header) );
+    chunk_first_timestamp = header.timestamp;
+  }
+  const uint8_t * header_bytes = reinterpret_cast<const uint8_t *>(&header);
+  chunk.insert( chunk.end(), header_bytes, header_bytes + sizeof(header) );
+  if ( color_bytes )
+  {
+    const uint8_t * color_data = reinterpret_cast<const uint8_t *>(color.get_data());
+    chunk.insert( chunk.end(), color_data, color_data + color_bytes );
+  }
+  chunk.insert( chunk.end(), encoded_depth.data(), encoded_depth.data() + depth_bytes );
+  chunk_frames++;
+  recorded++;
+  depth_raw_bytes += depth_pixels * sizeof(uint16_t);
+  depth_compressed_bytes += depth_bytes;
+  if ( chunk_frames == CHUNK_FRAMES ) finish_chunk();
+}
+
+void frame_recorder::finish_chunk()
+{
+  if ( chunk_frames == 0 ) return;
+  recording_chunk_header header = { RECORDING_CHUNK_MAGIC, chunk_frames,
+                                    chunk.size() - sizeof(recording_chunk_header), chunk_first_timestamp };
+  memcpy( chunk.data(), &header, sizeof(header) );
+  chunk_frames = 0;
+  {
+    lock_guard<mutex> lock(write_mutex);
+    write_behind += chunk.size();
+    full_chunks.push_back( std::move(chunk) );
+    // spare buffers already have the capacity of a chunk
+    chunk.clear();
+    if ( !spare_chunks.empty() )
+    {
+      chunk.swap( spare_chunks.back() );
+      spare_chunks.pop_back();
+    }
+  }
+  chunk_ready.notify_one();
+}
+
+void frame_recorder::write_chunks()
+{
+  unique_lock<mutex> lock(write_mutex);
+  for ( ;; )
+  {
+    chunk_ready.wait( lock, [this]{ return !full_chunks.empty() || writer_stopping; } );
+    if ( full_chunks.empty() ) break;
+    vector<uint8_t> data;
+    data.swap( full_chunks.front() );
+    full_chunks.pop_front();
+    lock.unlock();
+
+    if ( !write_failed )
+    {
+      if ( fwrite( data.data(), 1, data.size(), file ) == data.size() )
+      {
+        recording_chunk_header header;
+        memcpy( &header, data.data(), sizeof(header) );
+        recording_index_entry entry = { file_offset, header.first_timestamp, header.frame_count, 0 };
+        index.push_back( entry );
+        file_offset += data.size();
+        written += data.size();
+      }
+      else
+      {
+        cerr << "Recording " << file_path << " could not be written, disk full?\n";
+        write_failed = true;
+      }
+    }
+
+    lock.lock();
+    write_behind -= data.size();
+    data.clear();
+    spare_chunks.push_back( std::move(data) );
+  }
+  lock.unlock();
+  if ( !write_failed ) write_index();
+}
+
+void frame_recorder::write_index()
+{
+  recording_trailer trailer = { file_offset, (uint32_t)index.size(), RECORDING_INDEX_MAGIC };
+  if ( !index.empty() ) fwrite( index.data(), sizeof(recording_index_entry), index.size(), file );
+  fwrite( &trailer, sizeof(trailer), 1, file );
+}
+
+double frame_recorder::compression_ratio() const
+{
+  uint64_t compressed = depth_compressed_bytes;
+  return compressed ? (double)depth_raw_bytes / compressed : 0.0;
+}
+
+string frame_recorder::status() const
+{
+  stringstream ss;
+  ss << "Recording " << file_path << ": " << recorded << " frames, " << dropped << " dropped, "
+     << written / (1024 * 1024) << " MB written, depth compressed " << compression_ratio() << ":1";
+  if ( write_failed ) ss << ", WRITE FAILED";
+  return ss.str();
+}
+
+recording_reader::~recording_reader()
+{
+  if ( file ) fclose( file );
+}
+
+bool recording_reader::open( const string & path )
+{
+  if ( file ) fclose( file );
+  index.clear();
+  next_chunk = 0;
+  frames_left = 0;
+  file = fopen( path.c_str(), "rb" );
+  if ( file == nullptr ) return false;
+  char magic[sizeof(RECORDING_MAGIC)];
+  if ( fread( magic, sizeof(magic), 1, file ) != 1 || memcmp( magic, RECORDING_MAGIC, sizeof(magic) ) != 0 )
+  {
+    fclose( file );
+    file = nullptr;
+    return false;
+  }
+  const uint64_t size = file_size( file );
+  recording_trailer trailer;
+  if ( size >= sizeof(RECORDING_MAGIC) + sizeof(trailer) &&
+       seek_to( file, size - sizeof(trailer) ) && fread( &trailer, sizeof(trailer), 1, file ) == 1 &&
+       trailer.magic == RECORDING_INDEX_MAGIC &&
+       trailer.index_offset + trailer.chunk_count * sizeof(recording_index_entry) + sizeof(trailer) == size )
+  {
+    index.resize( trailer.chunk_count );
+    if ( trailer.chunk_count == 0 ||
+         (seek_to( file, trailer.index_offset ) &&
+          fread( index.data(), sizeof(recording_index_entry), index.size(), file ) == index.size()) )
+      return true;
+    index.clear();
+  }
+  // no index, find chunks up to the first incomplete one
+  uint64_t offset = sizeof(RECORDING_MAGIC);
+  recording_chunk_header header;
+  while ( seek_to( file, offset ) && fread( &header, sizeof(header), 1, file ) == 1 &&
+          header.magic == RECORDING_CHUNK_MAGIC && offset + sizeof(header) + header.payload_bytes <= size )
+  {
+    recording_index_entry entry = { offset, header.first_timestamp, header.frame_count, 0 };
+    index.push_back( entry );
+    offset += sizeof(header) + header.payload_bytes;
+  }
+  cerr << path << " has no index, found " << index.size() << " complete chunks\n";
+  return true;
+}
+
+void recording_reader::seek( double timestamp )
+{
+  next_chunk = 0;
+  frames_left = 0;
+  for ( size_t i = 0; i < index.size() && index[i].first_timestamp <= timestamp; i++ ) next_chunk = i;
+}
+
+bool recording_reader::start_chunk( size_t chunk )
+{
+  recording_chunk_header header;
+  if ( !seek_to( file, index[chunk].offset ) || fread( &header, sizeof(header), 1, file ) != 1 ||
+       header.magic != RECORDING_CHUNK_MAGIC ) return false;
+  frames_left = header.frame_count;
+  next_chunk = chunk + 1;
+  return true;
+}
+
+bool recording_reader::next_frame( recording_frame_header & header, const uint8_t *& color, vector<uint16_t> & depth )
+{
+  if ( file == nullptr ) return false;
+  while ( frames_left == 0 )
+  {
+    if ( next_chunk >= index.size() || !start_chunk( next_chunk ) ) return false;
+  }
+  if ( fread( &header, sizeof(header), 1, file ) != 1 ) return false;
+  color_buffer.resize( header.color_bytes );
+  depth_buffer.resize( header.depth_bytes );
+  if ( (header.color_bytes && fread( color_buffer.data(), header.color_bytes, 1, file ) != 1) ||
+       (header.depth_bytes && fread( depth_buffer.data(), header.depth_bytes, 1, file ) != 1) ) return false;
+  depth.resize( (size_t)header.depth_width * header.depth_height );
+  if ( !rvl_decode( depth_buffer.data(), depth_buffer.size(), depth.data(), depth.size() ) ) return false;
+  color = color_buffer.data();
+  frames_left--;
+  return true;
+}
@@ -0,0 +1,190 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <librealsense2/rs.hpp>
+#include "thread_pool.h"
+
+// Recording file layout: file magic, chunks, chunk index and trailer.
+// Values are in host byte order, little endian on every platform the
+// plugin builds for. Each chunk starts with a header of its own, so a file
+// cut short by a crash can still be read up to its last complete chunk.
+// The index at the end tells where chunks start, for seeking by timestamp.
+// A chunk holds frames, each a frame header, color bytes as streamed and
+// depth compressed with rvl_encode.
+const char RECORDING_MAGIC[8] = { 'R', 'S', 'D', 'E', 'P', 'T', 'H', '1' };
+const uint32_t RECORDING_CHUNK_MAGIC = 0x4b4e4843; // "CHNK"
+const uint32_t RECORDING_INDEX_MAGIC = 0x58444e49; // "INDX"
+
+struct recording_chunk_header
+{
+  uint32_t magic;
+  uint32_t frame_count;
+  // bytes of frames following this header
+  uint64_t payload_bytes;
+  double first_timestamp;
+};
+
+struct recording_frame_header
+{
+  uint64_t frame_number;
+  // device timestamp in milliseconds
+  double timestamp;
+  // rs2_format of color
+  uint32_t color_format;
+  uint16_t color_width;
+  uint16_t color_height;
+  uint32_t color_bytes;
+  uint16_t depth_width;
+  uint16_t depth_height;
+  // compressed size
+  uint32_t depth_bytes;
+  // meters per depth unit
+  float depth_units;
+};
+
+struct recording_index_entry
+{
+  // file offset of chunk header
+  uint64_t offset;
+  double first_timestamp;
+  uint32_t frame_count;
+  uint32_t reserved;
+};
+
+struct recording_trailer
+{
+  uint64_t index_offset;
+  uint32_t chunk_count;
+  uint32_t magic;
+};
+
+// Records color and raw depth of framesets into a file without ever
+// blocking whoever hands them in. Framesets wait in a short queue for an
+// encoder task on the shared thread pool, which compresses depth into
+// chunks. Finished chunks are written by a thread of the recorder's own,
+// from a bounded write-behind buffer, so a stalled disk holds up neither
+// capture nor the pool. Frames that find the queue or the buffer full are
+// dropped and counted.
+class frame_recorder
+{
+public:
+  static const size_t QUEUE_FRAMES = 8;
+  // frames per chunk, fewer when they would take over a quarter of write-behind buffer
+  static const size_t CHUNK_FRAMES = 30;
+  static const size_t DEFAULT_WRITE_BEHIND_BYTES = 64 << 20;
+
+  explicit frame_recorder( thread_pool & pool, size_t write_behind_bytes = DEFAULT_WRITE_BEHIND_BYTES );
+  virtual ~frame_recorder();
+  // Creates file and starts accepting framesets. Throws std::runtime_error
+  // if file cannot be created.
+  void start( const std::string & path );
+  // Records framesets already queued, writes index and closes file.
+  void stop();
+  bool recording() const { return accepting; }
+  // Queues frameset from any thread, returns false if it was dropped.
+  bool record( const rs2::frameset & frames );
+
+  uint64_t frames_recorded() const { return recorded; }
+  uint64_t frames_dropped() const { return dropped; }
+  uint64_t bytes_written() const { return written; }
+  // raw depth bytes per compressed byte so far
+  double compression_ratio() const;
+  // one line summary for statistics
+  std::string status() const;
+protected:
+  thread_pool & pool;
+  const size_t write_behind_limit;
+  std::atomic_bool accepting{ false };
+  std::string file_path;
+
+  // framesets waiting for encoder, a ring of QUEUE_FRAMES
+  std::mutex queue_mutex;
+  rs2::frameset queue[QUEUE_FRAMES];
+  size_t queue_first{ 0 };
+  size_t queue_count{ 0 };
+  pool_task * encoder{ nullptr };
+
+  // Owned by encoder: chunk being filled and scratch for compressed depth.
+  std::vector<uint8_t> chunk;
+  uint32_t chunk_frames{ 0 };
+  double chunk_first_timestamp{ 0.0 };
+  std::vector<uint8_t> encoded_depth;
+  void encode_queued();
+  void encode( const rs2::frameset & frames );
+  // hands chunk to writer, taking a spare buffer in its place
+  void finish_chunk();
+
+  // Chunks waiting for writer, and emptied ones kept for reuse.
+  std::mutex write_mutex;
+  std::condition_variable chunk_ready;
+  std::deque<std::vector<uint8_t>> full_chunks;
+  std::vector<std::vector<uint8_t>> spare_chunks;
+  // bytes in full_chunks and being written
+  size_t write_behind{ 0 };
+  bool writer_stopping{ false };
+  std::thread writer;
+  FILE * file{ nullptr };
+  // where next chunk goes, and chunks written so far
+  uint64_t file_offset{ 0 };
+  std::vector<recording_index_entry> index;
+  void write_chunks();
+  void write_index();
+
+  std::atomic<uint64_t> recorded{ 0 };
+  std::atomic<uint64_t> dropped{ 0 };
+  std::atomic<uint64_t> written{ 0 };
+  std::atomic<uint64_t> depth_raw_bytes{ 0 };
+  std::atomic<uint64_t> depth_compressed_bytes{ 0 };
+  std::atomic_bool write_failed{ false };
+};
+
+// Reads recordings written by frame_recorder.
+class recording_reader
+{
+public:
+  virtual ~recording_reader();
+  // Opens file and reads its index, or walks chunk headers to rebuild it
+  // when recording was not stopped cleanly. Returns false if file is not a
+  // recording.
+  bool open( const std::string & path );
+  const std::vector<recording_index_entry> & chunks() const { return index; }
+  // Continues reading from first frame of the last chunk starting at or
+  // before timestamp.
+  void seek( double timestamp );
+  // Reads next frame. color points to data that stays valid until next
+  // call. Returns false at end of recording or at damaged data.
+  bool next_frame( recording_frame_header & header, const uint8_t *& color, std::vector<uint16_t> & depth );
+protected:
+  FILE * file{ nullptr };
+  std::vector<recording_index_entry> index;
+  size_t next_chunk{ 0 };
+  uint32_t frames_left{ 0 };
+  std::vector<uint8_t> color_buffer;
+  std::vector<uint8_t> depth_buffer;
+  bool start_chunk( size_t chunk );
+};
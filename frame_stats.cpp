@@ -0,0 +1,246 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "frame_stats.h"
+#include <cstdio>
+using namespace std;
+
+rolling_histogram::rolling_histogram()
+{
+  for ( int i = 0; i < BUCKET_COUNT; i++ ) buckets[i] = 0;
+  count = 0;
+  sum = 0;
+  max = 0;
+}
+
+// values below 8 get a bucket each, above that four buckets per power of two
+int rolling_histogram::bucket_of( uint32_t value )
+{
+  if ( value < 2 * BUCKETS_PER_OCTAVE ) return (int)value;
+  int octave = 0;
+  while ( (value >> octave) >= 2 * BUCKETS_PER_OCTAVE ) octave++;
+  return (octave + 1) * BUCKETS_PER_OCTAVE + (int)((value >> octave) - BUCKETS_PER_OCTAVE);
+}
+
+uint32_t rolling_histogram::bucket_limit( int bucket )
+{
+  if ( bucket < 2 * BUCKETS_PER_OCTAVE ) return (uint32_t)bucket;
+  int octave = bucket / BUCKETS_PER_OCTAVE - 1;
+  uint64_t first = (uint64_t)(bucket % BUCKETS_PER_OCTAVE + BUCKETS_PER_OCTAVE) << octave;
+  uint64_t limit = first + ((uint64_t)1 << octave) - 1;
+  return limit > UINT32_MAX ? UINT32_MAX : (uint32_t)limit;
+}
+
+void rolling_histogram::record( uint32_t value )
+{
+  buckets[bucket_of(value)].fetch_add(1, memory_order_relaxed);
+  count.fetch_add(1, memory_order_relaxed);
+  sum.fetch_add(value, memory_order_relaxed);
+  uint32_t previous = max.load(memory_order_relaxed);
+  while ( value > previous && !max.compare_exchange_weak(previous, value, memory_order_relaxed) ) {}
+}
+
+void rolling_histogram::take( snapshot & out )
+{
+  for ( int i = 0; i < BUCKET_COUNT; i++ ) out.buckets[i] = buckets[i].exchange(0, memory_order_relaxed);
+  out.count = count.exchange(0, memory_order_relaxed);
+  out.sum = sum.exchange(0, memory_order_relaxed);
+  out.max = max.exchange(0, memory_order_relaxed);
+}
+
+uint32_t rolling_histogram::snapshot::percentile( double fraction ) const
+{
+  uint64_t total = 0;
+  for ( int i = 0; i < BUCKET_COUNT; i++ ) total += buckets[i];
+  if ( total == 0 ) return 0;
+  uint64_t wanted = (uint64_t)(fraction * total + 0.5);
+  if ( wanted < 1 ) wanted = 1;
+  uint64_t seen = 0;
+  for ( int i = 0; i < BUCKET_COUNT; i++ )
+  {
+    seen += buckets[i];
+    // bucket limit may exceed largest value actually seen
+    if ( seen >= wanted ) return bucket_limit(i) < max ? bucket_limit(i) : max;
+  }
+  return max;
+}
+
+enqueue_history::enqueue_history()
+{
+  for ( int i = 0; i < SIZE; i++ )
+  {
+    frame_numbers[i] = 0;
+    times[i] = -1;
+  }
+  newest_frame = 0;
+}
+
+void enqueue_history::record( uint64_t frame_number, int64_t time_ns )
+{
+  size_t slot = frame_number % SIZE;
+  // invalidate slot while it is rewritten, find() checks number before and after reading time
+  frame_numbers[slot].store(0, memory_order_release);
+  times[slot].store(time_ns, memory_order_release);
+  frame_numbers[slot].store(frame_number, memory_order_release);
+  newest_frame.store(frame_number, memory_order_release);
+}
+
+int64_t enqueue_history::find( uint64_t frame_number ) const
+{
+  size_t slot = frame_number % SIZE;
+  if ( frame_numbers[slot].load(memory_order_acquire) != frame_number ) return -1;
+  int64_t time_ns = times[slot].load(memory_order_acquire);
+  if ( frame_numbers[slot].load(memory_order_acquire) != frame_number ) return -1;
+  return time_ns;
+}
+
+frame_stats::frame_stats()
+{
+  window_start_ns = stats_now_ns();
+}
+
+void frame_stats::record_us( latency which, double us )
+{
+  latencies[which].record(us < 0.0 ? 0 : us > 4e9 ? UINT32_MAX : (uint32_t)us);
+}
+
+void frame_stats::frame_received( uint64_t frame_number, int64_t arrival_ms, int64_t now_ns )
+{
+  received.fetch_add(1, memory_order_relaxed);
+  if ( last_received != 0 && frame_number > last_received + 1 )
+  {
+    camera_drops.fetch_add(frame_number - last_received - 1, memory_order_relaxed);
+  }
+  last_received = frame_number;
+  if ( arrival_ms > 0 )
+  {
+    int64_t system_ms = chrono::duration_cast<chrono::milliseconds>(
+      chrono::system_clock::now().time_since_epoch()).count();
+    record_us(LATENCY_PIPELINE, (system_ms - arrival_ms) * 1000.0);
+  }
+  enqueued.record(frame_number, now_ns);
+}
+
+int64_t frame_stats::frame_dequeued( uint64_t frame_number, int64_t now_ns )
+{
+  // frames skipped since previous dequeue, but which were queued, were dropped by the queue
+  if ( last_dequeued != 0 && frame_number > last_dequeued + 1 )
+  {
+    uint64_t first = frame_number - last_dequeued - 1 > enqueue_history::SIZE ?
+                     frame_number - enqueue_history::SIZE : last_dequeued + 1;
+    uint64_t dropped = 0;
+    for ( uint64_t n = first; n < frame_number; n++ )
+    {
+      if ( enqueued.find(n) >= 0 ) dropped++;
+    }
+    queue_drops.fetch_add(dropped, memory_order_relaxed);
+  }
+  last_dequeued = frame_number;
+
+  uint64_t newest = enqueued.newest();
+  queue_depth.record(newest > frame_number ? (uint32_t)(newest - frame_number) : 0);
+  int64_t queued_ns = enqueued.find(frame_number);
+  if ( queued_ns < 0 ) return now_ns;
+  record_us(LATENCY_QUEUE, (now_ns - queued_ns) / 1000.0);
+  return queued_ns;
+}
+
+void frame_stats::frame_processed( const double * stage_us )
+{
+  processed.fetch_add(1, memory_order_relaxed);
+  for ( int s = 0; s < STAGE_COUNT; s++ )
+  {
+    // stages that did not run are left out of percentiles
+    if ( stage_us[s] > 0.0 ) record_us((latency)(LATENCY_STAGE_FIRST + s), stage_us[s]);
+  }
+}
+
+void frame_stats::frame_shown( int64_t received_ns, int64_t published_ns, int64_t upload_start_ns, int64_t now_ns )
+{
+  shown.fetch_add(1, memory_order_relaxed);
+  if ( published_ns > 0 && upload_start_ns >= published_ns )
+  {
+    record_us(LATENCY_HANDOFF, (upload_start_ns - published_ns) / 1000.0);
+  }
+  record_us(LATENCY_UPLOAD, (now_ns - upload_start_ns) / 1000.0);
+  if ( received_ns > 0 ) record_us(LATENCY_TOTAL, (now_ns - received_ns) / 1000.0);
+}
+
+bool frame_stats::report_due( int64_t now_ns ) const
+{
+  return now_ns - window_start_ns >= (int64_t)(STATS_REPORT_INTERVAL_SECONDS * 1e9);
+}
+
+static const char * latency_name( int which )
+{
+  switch ( which )
+  {
+  case frame_stats::LATENCY_PIPELINE: return "pipeline";
+  case frame_stats::LATENCY_QUEUE:    return "queue";
+  case frame_stats::LATENCY_HANDOFF:  return "handoff";
+  case frame_stats::LATENCY_UPLOAD:   return "upload";
+  case frame_stats::LATENCY_TOTAL:    return "total";
+  case frame_stats::LATENCY_SKEW:     return "skew to first camera";
+  case frame_stats::LATENCY_RESTART:  return "idle restart";
+  default: return processing_stage_name(which - frame_stats::LATENCY_STAGE_FIRST);
+  }
+}
+
+string frame_stats::report( const string & name )
+{
+  int64_t now_ns = stats_now_ns();
+  double seconds = (now_ns - window_start_ns.exchange(now_ns)) * 1e-9;
+  uint64_t published_frames = published.exchange(0, memory_order_relaxed);
+  uint64_t shown_frames = shown.exchange(0, memory_order_relaxed);
+  rolling_histogram::snapshot snap;
+  queue_depth.take(snap);
+
+  char line[256];
+  string text;
+  snprintf(line, sizeof(line),
+           "RealSense %s: %llu frames received, %llu processed in %.1f s\n"
+           "  dropped by camera %llu, by queue %llu, before shown %llu; queue depth p50 %u max %u\n",
+           name.c_str(),
+           (unsigned long long)received.exchange(0, memory_order_relaxed),
+           (unsigned long long)processed.exchange(0, memory_order_relaxed), seconds,
+           (unsigned long long)camera_drops.exchange(0, memory_order_relaxed),
+           (unsigned long long)queue_drops.exchange(0, memory_order_relaxed),
+           (unsigned long long)(published_frames > shown_frames ? published_frames - shown_frames : 0),
+           snap.percentile(0.5), snap.max);
+  text += line;
+  snprintf(line, sizeof(line), "  %-20s %9s %9s %9s %9s\n", "latency (us)", "p50", "p95", "p99", "max");
+  text += line;
+  for ( int i = 0; i < LATENCY_COUNT; i++ )
+  {
+    latencies[i].take(snap);
+    if ( snap.count == 0 ) continue;
+    snprintf(line, sizeof(line), "  %-20s %9u %9u %9u %9u\n", latency_name(i),
+             snap.percentile(0.5), snap.percentile(0.95), snap.percentile(0.99), snap.max);
+    text += line;
+  }
+
+  lock_guard<mutex> lock(report_mutex);
+  last_report = text;
+  return text;
+}
+
+string frame_stats::latest_report()
+{
+  lock_guard<mutex> lock(report_mutex);
+  return last_report;
+}
@@ -0,0 +1,146 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include "obs_frame_processor.h"
+
+// how often statistics are written to log
+const double STATS_REPORT_INTERVAL_SECONDS = 10.0;
+
+// Monotonic clock for frame hand-off timestamps, in nanoseconds.
+inline int64_t stats_now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Counts values into logarithmic buckets, four per power of two, so
+// percentiles are accurate to within 25%. record() is a few relaxed atomic
+// operations and may be called from any thread; take() returns and clears
+// everything recorded since the previous take().
+class rolling_histogram
+{
+public:
+  enum { BUCKETS_PER_OCTAVE = 4, BUCKET_COUNT = 32 * BUCKETS_PER_OCTAVE };
+  struct snapshot
+  {
+    uint32_t buckets[BUCKET_COUNT];
+    uint64_t count;
+    uint64_t sum;
+    uint32_t max;
+    double mean() const { return count ? (double)sum / count : 0.0; }
+    // upper limit of bucket containing given fraction (0.0 - 1.0) of values
+    uint32_t percentile( double fraction ) const;
+  };
+
+  rolling_histogram();
+  void record( uint32_t value );
+  void take( snapshot & out );
+protected:
+  static int bucket_of( uint32_t value );
+  static uint32_t bucket_limit( int bucket );
+
+  std::atomic<uint32_t> buckets[BUCKET_COUNT];
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> sum;
+  std::atomic<uint32_t> max;
+};
+
+// Remembers when recent framesets were queued, so the consumer can tell
+// how long a frameset waited, and whether missing frame numbers were
+// dropped by the queue or never arrived from the camera.
+class enqueue_history
+{
+public:
+  enum { SIZE = 64 };
+  enqueue_history();
+  void record( uint64_t frame_number, int64_t time_ns );
+  // time frame was queued, or -1 if it is not among recent ones
+  int64_t find( uint64_t frame_number ) const;
+  uint64_t newest() const { return newest_frame; }
+protected:
+  std::atomic<uint64_t> frame_numbers[SIZE];
+  std::atomic<int64_t> times[SIZE];
+  std::atomic<uint64_t> newest_frame;
+};
+
+// Latencies of each hand-off of a frameset from librealsense to OBS, and
+// counts of frames lost on the way. Capture thread, frame worker and OBS
+// each record their own part; report() summarizes and restarts the window.
+class frame_stats
+{
+public:
+  enum latency
+  {
+    // librealsense time of arrival to capture thread, millisecond resolution
+    LATENCY_PIPELINE = 0,
+    // capture thread enqueue to frame worker dequeue
+    LATENCY_QUEUE,
+    // first of processing_stage values, in same order
+    LATENCY_STAGE_FIRST,
+    // frame worker publish to OBS tick picking up the frame
+    LATENCY_HANDOFF = LATENCY_STAGE_FIRST + STAGE_COUNT,
+    // texture upload, or obs_source_output_video with async output
+    LATENCY_UPLOAD,
+    // capture thread to upload finished
+    LATENCY_TOTAL,
+    // timestamp difference to first camera, recorded by device_manager
+    LATENCY_SKEW,
+    // source shown to first frameset after restart, with IDLE_STOP_STREAMING
+    LATENCY_RESTART,
+    LATENCY_COUNT
+  };
+  enqueue_history enqueued;
+
+  frame_stats();
+  // capture thread
+  void frame_received( uint64_t frame_number, int64_t arrival_ms, int64_t now_ns );
+  // frame worker, returns time frameset was queued
+  int64_t frame_dequeued( uint64_t frame_number, int64_t now_ns );
+  void frame_processed( const double * stage_us );
+  void frame_published() { published++; }
+  // OBS side, after upload is done
+  void frame_shown( int64_t received_ns, int64_t published_ns, int64_t upload_start_ns, int64_t now_ns );
+
+  void record_us( latency which, double us );
+  bool report_due( int64_t now_ns ) const;
+  // summarizes window since previous report, and keeps text for latest_report()
+  std::string report( const std::string & name );
+  std::string latest_report();
+protected:
+  rolling_histogram latencies[LATENCY_COUNT];
+  rolling_histogram queue_depth;
+  std::atomic<uint64_t> received{ 0 };
+  std::atomic<uint64_t> processed{ 0 };
+  std::atomic<uint64_t> published{ 0 };
+  std::atomic<uint64_t> shown{ 0 };
+  std::atomic<uint64_t> camera_drops{ 0 };
+  std::atomic<uint64_t> queue_drops{ 0 };
+  // only touched by capture thread
+  uint64_t last_received{ 0 };
+  // only touched by frame worker
+  uint64_t last_dequeued{ 0 };
+  std::atomic<int64_t> window_start_ns;
+  std::mutex report_mutex;
+  std::string last_report;
+};
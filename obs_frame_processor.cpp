@@ -19,113 +19,548 @@
 
 #include "obs_frame_processor.h"
 #include "realsense-device.h"
+#include "pixel_kernels.h"
+#include "depth_filters.h"
 #include <iostream>
 #include <algorithm>
+#include <cstring>
 using namespace std;
+
+const char * processing_stage_name( int stage )
+{
+  static const char * names[STAGE_COUNT] = {
+    "align", "decimation", "depth to disparity", "spatial", "temporal",
+    "disparity to depth", "hole filling", "composite"
+  };
+  return stage >= 0 && stage < STAGE_COUNT ? names[stage] : "unknown";
+}
+
+const char * output_layout_name( int layout )
+{
+  switch ( layout )
+  {
+  case LAYOUT_SIDE_BY_SIDE: return "Color and depth side by side";
+  case LAYOUT_ALPHA_MATTE:  return "Color keyed by depth";
+  case LAYOUT_COLOR_ONLY:   return "Color only";
+  case LAYOUT_DEPTH_ONLY:   return "Depth only";
+  case LAYOUT_STACKED:      return "Color above depth";
+  default:                  return "unknown";
+  }
+}
+
 obs_frame_processor::obs_frame_processor() :  depth_to_disparity(true),
                                                                       disparity_to_depth(false),
-                                                                      rs_device(nullptr)
+                                                                      rs_device(nullptr),
+                                                                      pending_filters(new depth_filter_settings())
 {
-	temporal.set_option(RS2_OPTION_HOLES_FILL, 1);
-	temporal.set_option(RS2_OPTION_FILTER_SMOOTH_DELTA, 10);
-	temporal.set_option(RS2_OPTION_FILTER_SMOOTH_ALPHA, 1.0f);
-	decimation.set_option(RS2_OPTION_FILTER_MAGNITUDE, 2);
-	spatial.set_option(RS2_OPTION_FILTER_SMOOTH_ALPHA, 1.0);
+  std::fill( stage_us, stage_us + STAGE_COUNT, 0.0 );
+  for ( auto & cost : stage_cost ) cost = 0.0f;
+  chain.reserve( STAGE_COUNT );
+  apply_filters();
+  capture_output( decimation );
+  capture_output( depth_to_disparity );
+  capture_output( spatial );
+  capture_output( temporal );
+  capture_output( disparity_to_depth );
+  capture_output( hole_filling_filter );
 }
 
-bool obs_frame_processor::update_context(rs2::frameset & frameset, rs2_stream * align_to)
+bool obs_frame_processor::update_context(rs2::frameset & frameset, rs2_stream * align_to, obs_frame_output & output)
 {
   if ( rs_device == nullptr ) throw runtime_error("Realsense device not set in obs_frame_processor");
+  std::fill( stage_us, stage_us + STAGE_COUNT, 0.0 );
+  clock::time_point mark = clock::now();
+  // color only layout does nothing with depth, not even filtering it,
+  // unless depth is shared with other processes
+  const bool composites_depth = layout != LAYOUT_COLOR_ONLY;
+#if defined(DEPTH_EXPORT)
+  // an open region is handed frames until export_depth has closed it
+  const bool exports_depth = export_requested || depth_export.is_open();
+#else
+  const bool exports_depth = false;
+#endif
+  const bool uses_depth = composites_depth || exports_depth;
+  const int alignment = depth_alignment;
+  if ( uses_depth && alignment == DEPTH_ALIGN_LIBREALSENSE && rs_device->align != nullptr )
+  {
+    if ( captured_align_generation != rs_device->align_generation )
+    {
+      capture_output( *rs_device->align );
+      captured_align_generation = rs_device->align_generation;
+    }
+    frameset = run_filter( *rs_device->align, frameset );
+    end_stage( STAGE_ALIGN, mark );
+  }
 	rs2::video_frame vid_frame = frameset.first(*align_to);
 	rs2::depth_frame depth_frame = frameset.get_depth_frame();
 
-	if (!vid_frame || !depth_frame)
+	if (!vid_frame || (composites_depth && !depth_frame))
 	{
           cerr << "one of two is missing\n";
           return false;
 	}
-
-	if (!depth_frame)
-	{
-          cerr << "depth frame is missing\n";
-          return false;
-	}
-	rs2::depth_frame filtered = depth_frame;
-	
-	// filter execution order matters!
-	filtered = decimation.process(filtered);
-	filtered = depth_to_disparity.process(filtered);
-	filtered = spatial.process(filtered);
-	filtered = temporal.process(filtered);
-	filtered = disparity_to_depth.process(filtered);
-  filtered = hole_filling_filter.process(filtered);
-  
+  if ( (size_t)vid_frame.get_width() != color_width || (size_t)vid_frame.get_height() != color_height )
+  {
+    cerr << "color frame size does not match output size\n";
+    return false;
+  }
 	const uint8_t *rgb_data = reinterpret_cast<const uint8_t *>(vid_frame.get_data());
+  output.timestamp = frameset.get_timestamp();
+  output.raw_depth = raw_depth && layout == LAYOUT_SIDE_BY_SIDE;
+  output.bytes_copied = 0;
+  output.color_frame = rs2::frame();
+  output.depth_frame = rs2::frame();
+  job.rgb_data = rgb_data;
+  job.rgb_stride = vid_frame.get_stride_in_bytes();
+  job.color_format = vid_frame.get_profile().format();
+  job.rgba = output.rgba.data();
+  if ( !composites_depth )
+  {
+#if defined(DEPTH_EXPORT)
+    // layout skips compositing depth, not sharing it
+    if ( exports_depth && depth_frame )
+    {
+      rs2::depth_frame filtered = filter_depth( depth_frame, mark );
+      if ( filtered.get_data() != nullptr ) output.bytes_copied += export_depth( filtered, frameset );
+    }
+#endif
+    if ( pass_yuyv && job.color_format == RS2_FORMAT_YUYV )
+    {
+      output.color_frame = vid_frame;
+      end_stage( STAGE_COMPOSITE, mark );
+      return true;
+    }
+    set_tile_outputs( output.rgba.data(), nullptr, color_width * 4 );
+    run_tiles( composite_tile );
+    output.bytes_copied += color_width * 4 * color_height;
+    end_stage( STAGE_COMPOSITE, mark );
+    return true;
+  }
+
+	rs2::depth_frame filtered = filter_depth( depth_frame, mark );
+
 	const uint16_t *depth_data = reinterpret_cast<const uint16_t *>(filtered.get_data());
 	if (depth_data == nullptr)
 	{
 		cerr << "depth data is null!\n";
 		return false;
 	}
-	for (size_t h = 0;h < video_height;h++)
-	{
-		for (size_t w = 0;w < video_width / 2;w++)
-		{
-
-			size_t color_data_source_index = h * (video_width / 2) + w;
-			size_t depth_index = h * video_width + w + (video_width / 2);
-			size_t color_index = h * video_width + w;
-			uint8_t R = rgb_data[color_data_source_index * 3];
-			uint8_t G = rgb_data[color_data_source_index * 3 + 1];
-			uint8_t B = rgb_data[color_data_source_index * 3 + 2];
-
-			// Since we decimate depth data to half, we need to compute proper index here.
-			// video_width / 4 since it is half of the half allocated image in respect to RGB image.
-			size_t depth_data_source_index = (h / 2)*(video_width / 4) + w / 2;
-
-			tmp_data[color_index * 4    ] = R;
-			tmp_data[color_index * 4 + 1] = G;
-			tmp_data[color_index * 4 + 2] = B;
-      tmp_data[color_index * 4 + 3] = 255; // alpha
-
-      // enforce depth values to 8-bit range, and mark 
-			const uint16_t MAX_RGB_VALUE = 255;
-      uint16_t dval16 = std::max((uint16_t)((depth_data[depth_data_source_index] - rs_device->depthClampMin) / 100), (uint16_t)0);
-      if ( dval16 > MAX_RGB_VALUE ) dval16 = 0;
-
-			uint8_t dval = (uint8_t)dval16;
-			tmp_data[depth_index * 4    ] = dval;
-			tmp_data[depth_index * 4 + 1] = dval;
-			tmp_data[depth_index * 4 + 2] = dval;
-			tmp_data[depth_index * 4 + 3] = 255; // alpha 
-		}
-	}
+  size_t depth_width = filtered.get_width();
+  size_t depth_height = filtered.get_height();
+  size_t depth_stride = filtered.get_stride_in_bytes() / sizeof(uint16_t);
+#if defined(DEPTH_EXPORT)
+  output.bytes_copied += export_depth( filtered, frameset );
+#endif
+  if ( alignment == DEPTH_ALIGN_CACHED )
+  {
+    aligner.align( filtered, depth_frame, vid_frame, output.aligned_depth );
+    depth_data = output.aligned_depth.data();
+    depth_width = depth_stride = color_width;
+    depth_height = color_height;
+    end_stage( STAGE_ALIGN, mark );
+  }
+  if ( output.raw_depth )
+  {
+    // RGBA color and depth are uploaded straight from librealsense frames.
+    if ( job.color_format == RS2_FORMAT_RGBA8 )
+    {
+      output.color_frame = vid_frame;
+    }
+    else
+    {
+      // RGB needs expanding anyway, since there is no 24-bit texture format,
+      // and YUYV is converted here rather than in the effect
+      set_tile_outputs( output.rgba.data(), nullptr, color_width * 4 );
+      run_tiles( composite_tile );
+      output.bytes_copied += color_width * color_height * 4;
+    }
+    if ( alignment != DEPTH_ALIGN_CACHED ) output.depth_frame = filtered;
+    output.depth_width  = depth_width;
+    output.depth_height = depth_height;
+    end_stage( STAGE_COMPOSITE, mark );
+    return true;
+  }
+
+  // depth is usually decimated, so it is scaled to color image size with nearest neighbour.
+  prepare_depth_columns( depth_width, color_width );
+  job.depth_data = depth_data;
+  job.depth_width = depth_width;
+  job.depth_height = depth_height;
+  job.depth_stride = depth_stride;
+  if ( layout == LAYOUT_ALPHA_MATTE )
+  {
+    // Alpha is keyed at depth resolution, which is a quarter of the pixels
+    // with decimation, and then scaled like depth in side by side.
+    if ( matte_changed )
+    {
+      lock_guard<mutex> lock(filters_mutex);
+      matte_changed = false;
+      matte_settings = pending_matte;
+    }
+    // settings are in millimetres, camera may switch depth units any time
+    float meters_per_unit = filtered.get_units();
+    if ( meters_per_unit <= 0.0f ) meters_per_unit = DEFAULT_DEPTH_UNITS * 1e-6f;
+    matte.update( matte_settings, meters_per_unit );
+    matte.resize( depth_width, depth_height );
+    run_tiles( matte_key_tile, depth_height );
+    run_tiles( matte_tile );
+    output.bytes_copied += video_width * 4 * video_height;
+    end_stage( STAGE_COMPOSITE, mark );
+    return true;
+  }
+  job.mapping = depth_mapping;
+  job.depth_lut = nullptr;
+  if ( job.mapping != DEPTH_MAP_STEPS )
+  {
+    // steps and packing are cheaper to compute than to look up, other
+    // mappings are not. Packing still uses the table for odd scaling ratios.
+    lut.update( job.mapping, rs_device->depthClampMin, rs_device->depthClampMax );
+    job.depth_lut = lut.table();
+  }
+  uint8_t * rgba = output.rgba.data();
+  switch ( layout )
+  {
+  case LAYOUT_DEPTH_ONLY:
+    set_tile_outputs( nullptr, rgba, color_width * 4 );
+    break;
+  case LAYOUT_STACKED:
+    set_tile_outputs( rgba, rgba + color_width * 4 * color_height, color_width * 4 );
+    break;
+  default:
+    set_tile_outputs( rgba, rgba + color_width * 4, video_width * 4 );
+    break;
+  }
+  run_tiles( composite_tile );
+  output.bytes_copied += video_width * 4 * video_height;
+  end_stage( STAGE_COMPOSITE, mark );
 
 	return true;
 }
 
-void obs_frame_processor::init( size_t width, size_t height, realsense_device * device )
+obs_frame_processor::~obs_frame_processor()
 {
-  video_width = width;
-  video_height = height;
-  rs_device = device;
-  tmp_data.resize( width * height * 4 ); // RGBA
+  delete tiles;
+  delete pending_filters;
 }
 
+void obs_frame_processor::set_filters( const depth_filter_settings & settings )
+{
+  lock_guard<mutex> lock(filters_mutex);
+  *pending_filters = settings;
+  filters_changed = true;
+}
 
-void obs_frame_processor::fill_rgba( uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+void obs_frame_processor::set_matte( const alpha_matte_settings & settings )
 {
-  for (size_t h = 0;h < video_height;h++)
-	{
-		for (size_t w = 0;w < video_width;w++)
-		{
-
-			size_t color_index = h * video_width + w;
-      tmp_data[color_index*4] = r;
-      tmp_data[color_index*4+1] = g;
-      tmp_data[color_index*4+2] = b;
-      tmp_data[color_index*4+3] = a;
-                  
+  lock_guard<mutex> lock(filters_mutex);
+  pending_matte = settings;
+  matte_changed = true;
+}
+
+rs2::depth_frame obs_frame_processor::filter_depth( const rs2::depth_frame & depth, clock::time_point & mark )
+{
+  rs2::depth_frame filtered = depth;
+  if ( filters_changed ) apply_filters();
+  for ( processing_stage stage : chain )
+  {
+    filtered = run_filter( filter_block(stage), filtered );
+    end_stage( stage, mark );
+  }
+  return filtered;
+}
+
+#if defined(DEPTH_EXPORT)
+void obs_frame_processor::set_depth_export( const string & name )
+{
+  lock_guard<mutex> lock(filters_mutex);
+  pending_export = name;
+  export_requested = !name.empty();
+  export_changed = true;
+}
+
+size_t obs_frame_processor::export_depth( const rs2::depth_frame & depth, const rs2::frameset & frameset )
+{
+  if ( export_changed )
+  {
+    string name;
+    {
+      lock_guard<mutex> lock(filters_mutex);
+      export_changed = false;
+      name = pending_export;
+    }
+    if ( name != depth_export.name() || name.empty() ) depth_export.close();
+    if ( !name.empty() && !depth_export.is_open() )
+      depth_export.open( name, (size_t)depth.get_width() * depth.get_height() );
+  }
+  if ( !depth_export.is_open() ) return 0;
+  size_t pixels = (size_t)depth.get_width() * depth.get_height();
+  // filter settings can make depth larger, region is then replaced
+  if ( pixels > depth_export.max_pixels() &&
+       !depth_export.open( depth_export.name(), pixels ) ) return 0;
+
+  rs2_intrinsics in = depth.get_profile().as<rs2::video_stream_profile>().get_intrinsics();
+  depth_export_info info;
+  info.frame_number = depth.get_frame_number();
+  info.timestamp = frameset.get_timestamp();
+  info.timestamp_domain = frameset.get_frame_timestamp_domain();
+  info.depth_units = depth.get_units();
+  info.width = (uint32_t)depth.get_width();
+  info.height = (uint32_t)depth.get_height();
+  info.intrinsics.width = in.width;
+  info.intrinsics.height = in.height;
+  info.intrinsics.ppx = in.ppx;
+  info.intrinsics.ppy = in.ppy;
+  info.intrinsics.fx = in.fx;
+  info.intrinsics.fy = in.fy;
+  info.intrinsics.model = in.model;
+  std::copy( in.coeffs, in.coeffs + 5, info.intrinsics.coeffs );
+  depth_export.publish( info, reinterpret_cast<const uint16_t *>(depth.get_data()),
+                        (size_t)depth.get_stride_in_bytes() );
+  return pixels * sizeof(uint16_t);
+}
+#endif
+
+void obs_frame_processor::apply_filters()
+{
+  lock_guard<mutex> lock(filters_mutex);
+  filters_changed = false;
+  for ( size_t f = 0; f < DEPTH_FILTER_COUNT; f++ )
+  {
+    const depth_filter_desc & desc = depth_filters[f];
+    rs2::processing_block & block = filter_block( desc.stage );
+    for ( size_t o = 0; o < desc.option_count; o++ )
+    {
+      float value = pending_filters->values[f][o];
+      if ( block.get_option(desc.options[o].option) != value ) block.set_option( desc.options[o].option, value );
+    }
+  }
+  vector<processing_stage> stages = pending_filters->chain();
+  if ( stages != chain )
+  {
+    chain.assign( stages.begin(), stages.end() );
+    cerr << "Depth filters:";
+    for ( processing_stage stage : chain ) cerr << " " << processing_stage_name(stage);
+    cerr << "\n";
+  }
+}
+
+rs2::processing_block & obs_frame_processor::filter_block( processing_stage stage )
+{
+  switch ( stage )
+  {
+  case STAGE_DECIMATION:         return decimation;
+  case STAGE_DEPTH_TO_DISPARITY: return depth_to_disparity;
+  case STAGE_SPATIAL:            return spatial;
+  case STAGE_TEMPORAL:           return temporal;
+  case STAGE_DISPARITY_TO_DEPTH: return disparity_to_depth;
+  case STAGE_HOLE_FILLING:       return hole_filling_filter;
+  default: throw runtime_error("not a depth filter stage");
+  }
+}
+
+void obs_frame_processor::capture_output( rs2::processing_block & block )
+{
+  block.start( [this]( rs2::frame f ) { filter_output = f; } );
+}
+
+rs2::frame obs_frame_processor::run_filter( rs2::processing_block & block, const rs2::frame & frame )
+{
+  // processing blocks run synchronously, output is ready when invoke returns
+  block.invoke( frame );
+  rs2::frame result = filter_output;
+  filter_output = rs2::frame();
+  // nothing delivered means nothing was done
+  return result ? result : frame;
+}
+
+void obs_frame_processor::run_tiles( parallel_tiles::tile_function function, size_t rows )
+{
+  size_t workers = compositing_workers;
+  if ( workers == 0 ) workers = tile_pool ? tile_pool->size() : 1;
+  if ( tile_pool == nullptr ) workers = 1;
+  // this runs on a pool thread, so tiles are resized rather than deleted,
+  // which would wait for helpers that may be queued behind this very task
+  if ( workers > 1 && tiles == nullptr ) tiles = new parallel_tiles( *tile_pool, workers );
+  else if ( tiles && tiles->workers() != workers ) tiles->set_workers( workers );
+  job.processor = this;
+  if ( rows == 0 ) rows = color_height;
+  size_t tile_count = (rows + TILE_ROWS - 1) / TILE_ROWS;
+  if ( tiles && workers > 1 ) tiles->run( tile_count, function, &job );
+  else for ( size_t t = 0; t < tile_count; t++ ) function( &job, t );
+}
+
+void obs_frame_processor::composite_tile( void * context, size_t tile )
+{
+  composite_job & job = *reinterpret_cast<composite_job*>(context);
+  obs_frame_processor & p = *job.processor;
+  const size_t width = p.color_width;
+  const size_t row_bytes = job.row_bytes;
+  size_t first = tile * TILE_ROWS;
+  size_t end = min( first + TILE_ROWS, p.color_height );
+  size_t prev_source_row = (size_t)-1;
+  for ( size_t h = first; h < end; h++ )
+  {
+    if ( job.color_out )
+      p.color_to_rgba( job.rgb_data + h * job.rgb_stride, job.color_format, job.color_out + h * row_bytes, width );
+    if ( job.depth_out == nullptr ) continue;
+
+    // rows sampling the same depth row are identical, no need to convert again.
+    uint8_t *depth_row = job.depth_out + h * row_bytes;
+    size_t source_row = h * job.depth_height / p.color_height;
+    if ( source_row == prev_source_row )
+      memcpy( depth_row, depth_row - row_bytes, width * 4 );
+    else
+      p.depth_to_rgba( job.depth_data + source_row * job.depth_stride, job.depth_width, depth_row, width );
+    prev_source_row = source_row;
+  }
+}
+
+void obs_frame_processor::set_tile_outputs( uint8_t * color_out, uint8_t * depth_out, size_t row_bytes )
+{
+  job.color_out = color_out;
+  job.depth_out = depth_out;
+  job.row_bytes = row_bytes;
+}
+
+void obs_frame_processor::matte_key_tile( void * context, size_t tile )
+{
+  composite_job & job = *reinterpret_cast<composite_job*>(context);
+  obs_frame_processor & p = *job.processor;
+  size_t end = min( (tile + 1) * TILE_ROWS, job.depth_height );
+  for ( size_t h = tile * TILE_ROWS; h < end; h++ )
+  {
+    p.matte.key_row( job.depth_data + h * job.depth_stride, h );
+  }
+}
+
+void obs_frame_processor::matte_tile( void * context, size_t tile )
+{
+  composite_job & job = *reinterpret_cast<composite_job*>(context);
+  obs_frame_processor & p = *job.processor;
+  const size_t width = p.color_width;
+  const bool doubled = width == job.depth_width * 2;
+  const bool same = width == job.depth_width;
+  size_t end = min( (tile + 1) * TILE_ROWS, p.color_height );
+  for ( size_t h = tile * TILE_ROWS; h < end; h++ )
+  {
+    uint8_t *row = job.rgba + h * width * 4;
+    p.color_to_rgba( job.rgb_data + h * job.rgb_stride, job.color_format, row, width );
+    const uint8_t *alpha = p.matte.alpha_row( h * job.depth_height / p.color_height );
+    if ( same )
+      for ( size_t w = 0; w < width; w++ ) row[w * 4 + 3] = alpha[w];
+    else if ( doubled )
+      for ( size_t w = 0; w < width; w++ ) row[w * 4 + 3] = alpha[w >> 1];
+    else
+      for ( size_t w = 0; w < width; w++ ) row[w * 4 + 3] = alpha[p.depth_columns[w]];
+  }
+}
+
+void obs_frame_processor::fill_tile( void * context, size_t tile )
+{
+  composite_job & job = *reinterpret_cast<composite_job*>(context);
+  obs_frame_processor & p = *job.processor;
+  size_t end = min( (tile + 1) * TILE_ROWS, p.video_height );
+  for ( size_t h = tile * TILE_ROWS; h < end; h++ )
+  {
+    uint8_t *row = job.rgba + h * p.video_width * 4;
+    for ( size_t w = 0; w < p.video_width; w++ ) memcpy( row + w * 4, job.fill, 4 );
+  }
+}
+
+void obs_frame_processor::end_stage( processing_stage stage, clock::time_point & mark )
+{
+  clock::time_point now = clock::now();
+  stage_us[stage] = chrono::duration<double, micro>(now - mark).count();
+  // moving average over about 20 frames
+  float cost = stage_cost[stage];
+  stage_cost[stage] = cost > 0.0f ? cost * 0.95f + (float)stage_us[stage] * 0.05f : (float)stage_us[stage];
+  mark = now;
+}
+
+void obs_frame_processor::color_to_rgba( const uint8_t *src, rs2_format format, uint8_t *dst, size_t pixels )
+{
+  if ( format == RS2_FORMAT_RGBA8 )
+    memcpy( dst, src, pixels * 4 );
+  else if ( format == RS2_FORMAT_YUYV )
+    get_pixel_kernels().yuyv_to_rgba( src, dst, pixels );
+  else
+    get_pixel_kernels().rgb_to_rgba( src, dst, pixels );
+}
+
+void obs_frame_processor::depth_to_rgba( const uint16_t *src, size_t src_pixels, uint8_t *dst, size_t dst_pixels )
+{
+  const pixel_kernels & kernels = get_pixel_kernels();
+  const uint32_t * table = job.depth_lut;
+  const bool scaled_by_1_or_2 = dst_pixels == src_pixels * 2 || dst_pixels == src_pixels;
+  if ( job.mapping == DEPTH_MAP_PACKED16 && scaled_by_1_or_2 )
+  {
+    kernels.depth_pack( src, dst, dst_pixels, dst_pixels != src_pixels );
+    return;
+  }
+  if ( table != nullptr )
+  {
+    if ( scaled_by_1_or_2 )
+    {
+      kernels.depth_lookup( src, table, dst, dst_pixels, dst_pixels != src_pixels );
+    }
+    else
+    {
+      for ( size_t i = 0; i < dst_pixels; i++ ) memcpy( dst + i * 4, table + src[depth_columns[i]], 4 );
+    }
+    return;
+  }
+  uint16_t clamp_min = rs_device->depthClampMin;
+  if ( dst_pixels == src_pixels * 2 )
+  {
+    kernels.depth_to_gray( src, dst, dst_pixels, clamp_min, true );
+  }
+  else if ( dst_pixels == src_pixels )
+  {
+    kernels.depth_to_gray( src, dst, dst_pixels, clamp_min, false );
+  }
+  else
+  {
+    // arbitrary ratio, columns come from prepare_depth_columns
+    for ( size_t i = 0; i < dst_pixels; i++ )
+    {
+      uint8_t dval = depth_to_gray_value( src[depth_columns[i]], clamp_min );
+      dst[i*4    ] = dval;
+      dst[i*4 + 1] = dval;
+      dst[i*4 + 2] = dval;
+      dst[i*4 + 3] = 255; // alpha
     }
   }
 }
+
+// Source column of each output pixel is computed once per size, before
+// tiles start so they only read it.
+void obs_frame_processor::prepare_depth_columns( size_t src_pixels, size_t dst_pixels )
+{
+  if ( dst_pixels == src_pixels || dst_pixels == src_pixels * 2 ) return;
+  if ( depth_columns.size() == dst_pixels && depth_columns_source_width == src_pixels ) return;
+  depth_columns.resize( dst_pixels );
+  for ( size_t i = 0; i < dst_pixels; i++ ) depth_columns[i] = (uint32_t)(i * src_pixels / dst_pixels);
+  depth_columns_source_width = src_pixels;
+}
+
+void obs_frame_processor::init( size_t width, size_t height, realsense_device * device, int layout )
+{
+  color_width = width;
+  color_height = height;
+  this->layout = layout;
+  video_width = layout == LAYOUT_SIDE_BY_SIDE ? width * 2 : width;
+  video_height = layout == LAYOUT_STACKED ? height * 2 : height;
+  rs_device = device;
+  cerr << "Using " << get_pixel_kernels().name << " pixel kernels\n";
+}
+
+
+void obs_frame_processor::fill_rgba( uint8_t * output, uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+  job.rgba = output;
+  job.fill[0] = r;
+  job.fill[1] = g;
+  job.fill[2] = b;
+  job.fill[3] = a;
+  run_tiles( fill_tile, video_height );
+}
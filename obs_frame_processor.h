@@ -18,14 +18,91 @@
 */
 #pragma once
 #include <vector>
+#include <atomic>
+#include <chrono>
+#include <mutex>
 #include <librealsense2/rs.hpp> 
+#include "depth_aligner.h"
+#include "thread_pool.h"
+#include "depth_lut.h"
+#include "alpha_matte.h"
+#if defined(DEPTH_EXPORT)
+#include "depth_export.h"
+#endif
 
 class realsense_device;
+struct depth_filter_settings;
+
+// How depth is registered to color pixels.
+enum depth_alignment_mode
+{
+  DEPTH_ALIGN_NONE = 0,
+  // rs2::align on the frameset, before filtering
+  DEPTH_ALIGN_LIBREALSENSE = 1,
+  // depth_aligner with cached reprojection, after filtering
+  DEPTH_ALIGN_CACHED = 2
+};
+
+// What the composited image holds.
+enum output_layout
+{
+  // color on the left, depth on the right, at double width
+  LAYOUT_SIDE_BY_SIDE = 0,
+  // color only, alpha keyed by depth, see alpha_matte.h
+  LAYOUT_ALPHA_MATTE,
+  // color alone, depth is not filtered or mapped
+  LAYOUT_COLOR_ONLY,
+  // depth alone at color size, color is not expanded
+  LAYOUT_DEPTH_ONLY,
+  // color above depth, at double height
+  LAYOUT_STACKED,
+  LAYOUT_COUNT
+};
+const char * output_layout_name( int layout );
+
+// Steps of update_context that are timed on every frame.
+enum processing_stage
+{
+  STAGE_ALIGN = 0,
+  STAGE_DECIMATION,
+  STAGE_DEPTH_TO_DISPARITY,
+  STAGE_SPATIAL,
+  STAGE_TEMPORAL,
+  STAGE_DISPARITY_TO_DEPTH,
+  STAGE_HOLE_FILLING,
+  STAGE_COMPOSITE,
+  STAGE_COUNT
+};
+const char * processing_stage_name( int stage );
+
+// Result of processing one frameset.
+struct obs_frame_output
+{
+  // composited RGBA image, or only the color image when raw_depth is set.
+  std::vector<uint8_t> rgba;
+  // When raw_depth is set, frames are referenced until uploaded instead of
+  // copying their data. color_frame is only set when it is already RGBA,
+  // otherwise color is in rgba. With obs_frame_processor::pass_yuyv,
+  // color_frame holds a YUYV frame and rgba is not written.
+  rs2::frame color_frame;
+  rs2::frame depth_frame;
+  // depth registered to color, used instead of depth_frame with DEPTH_ALIGN_CACHED
+  std::vector<uint16_t> aligned_depth;
+  size_t depth_width{ 0 };
+  size_t depth_height{ 0 };
+  bool raw_depth{ false };
+  // device timestamp of the frameset, in milliseconds
+  double timestamp{ 0.0 };
+  // bytes written by CPU while producing this output
+  size_t bytes_copied{ 0 };
+  // stats_now_ns() when capture thread queued the frameset, and when this was published
+  int64_t received_ns{ 0 };
+  int64_t published_ns{ 0 };
+};
 
 class obs_frame_processor 
 {
 public:
-  std::vector<uint8_t> tmp_data;
   rs2::decimation_filter decimation;
   rs2::spatial_filter spatial;
   rs2::temporal_filter temporal;
@@ -35,10 +112,138 @@ public:
   realsense_device *rs_device;
   size_t video_width{ 0 };
   size_t video_height{ 0 };
+  // size of color stream, set by init
+  size_t color_width{ 0 };
+  size_t color_height{ 0 };
+  // one of output_layout, set by init since it decides video size
+  int layout{ LAYOUT_SIDE_BY_SIDE };
+  // leave depth quantization and compositing to GPU, see data/realsense_depth.effect.
+  // Only side by side layout has a GPU path, others ignore this.
+  std::atomic_bool raw_depth{ false };
+  // one of depth_alignment_mode
+  std::atomic<int> depth_alignment{ DEPTH_ALIGN_NONE };
+  depth_aligner aligner;
+  // Color only layout leaves YUYV frames unconverted in output.color_frame,
+  // for async output where OBS converts YUY2 on GPU.
+  std::atomic_bool pass_yuyv{ false };
+  // one of depth_mapping, used when depth is quantized on CPU
+  std::atomic<int> depth_mapping{ DEPTH_MAP_STEPS };
+  // time each stage took during latest update_context, zero if stage did not run
+  double stage_us[STAGE_COUNT];
+  // Threads compositing one frame, including the processing thread; 0 means
+  // one per thread of tile_pool. Takes effect on next frame.
+  std::atomic<size_t> compositing_workers{ 0 };
+  // where compositing helpers run, compositing is single-threaded without one
+  thread_pool * tile_pool{ nullptr };
 	
   
   obs_frame_processor();
-  bool update_context(rs2::frameset & frameset, rs2_stream * align_to);
-  void init( size_t width, size_t height, realsense_device *device );
-  void fill_rgba( uint8_t r, uint8_t g, uint8_t b, uint8_t a);
+  virtual ~obs_frame_processor();
+  // Filters to run and their options, see depth_filters.h. Applied by the
+  // processing thread before next frame, so filters never change mid-frame.
+  void set_filters( const depth_filter_settings & settings );
+  // Keying of LAYOUT_ALPHA_MATTE, applied before next frame like filters.
+  void set_matte( const alpha_matte_settings & settings );
+#if defined(DEPTH_EXPORT)
+  // Shared memory region filtered depth is published into, see
+  // depth_export.h, or empty to stop. Applied before next frame.
+  void set_depth_export( const std::string & name );
+#endif
+  // time stage took per frame, averaged over recent frames it ran on
+  float stage_cost_us( int stage ) const { return stage_cost[stage]; }
+  // Composites frameset into output.rgba, which must hold video_width * video_height RGBA pixels.
+  bool update_context(rs2::frameset & frameset, rs2_stream * align_to, obs_frame_output & output);
+  // Sizes output for color stream of given size shown in layout.
+  void init( size_t width, size_t height, realsense_device *device, int layout = LAYOUT_SIDE_BY_SIDE );
+  void fill_rgba( uint8_t * output, uint8_t r, uint8_t g, uint8_t b, uint8_t a);
+protected:
+  typedef std::chrono::steady_clock clock;
+  // stores time since mark as duration of stage, and moves mark to now
+  void end_stage( processing_stage stage, clock::time_point & mark );
+  std::atomic<float> stage_cost[STAGE_COUNT];
+
+  // filter stages in order they run, disparity transforms included
+  std::vector<processing_stage> chain;
+  std::mutex filters_mutex;
+  depth_filter_settings * pending_filters;
+  std::atomic_bool filters_changed{ false };
+  // sets options and rebuilds chain from pending_filters
+  void apply_filters();
+  rs2::processing_block & filter_block( processing_stage stage );
+  // runs depth through filter chain, timing each stage
+  rs2::depth_frame filter_depth( const rs2::depth_frame & depth, clock::time_point & mark );
+
+  // guarded by filters_mutex like pending_filters
+  alpha_matte_settings pending_matte;
+  std::atomic_bool matte_changed{ true };
+  // pending_matte as of latest frame, owned by processing thread
+  alpha_matte_settings matte_settings;
+  alpha_matte matte;
+
+#if defined(DEPTH_EXPORT)
+  // guarded by filters_mutex like pending_filters
+  std::string pending_export;
+  std::atomic_bool export_changed{ false };
+  // pending_export is not empty, read without lock by processing thread
+  std::atomic_bool export_requested{ false };
+  depth_export_writer depth_export;
+  // publishes filtered depth, (re)creating region when frame does not fit
+  size_t export_depth( const rs2::depth_frame & depth, const rs2::frameset & frameset );
+#endif
+
+  // source column for each output pixel when depth is scaled by other than 1 or 2
+  std::vector<uint32_t> depth_columns;
+  size_t depth_columns_source_width{ 0 };
+  // depth colors for mappings other than DEPTH_MAP_STEPS
+  depth_lut lut;
+
+  // Output of the latest run_filter. Filters deliver into it from their
+  // callback, which is set up once so no frame needs an allocation.
+  rs2::frame filter_output;
+  // align_generation of rs_device align whose output is delivered to
+  // filter_output, 0 if none
+  uint64_t captured_align_generation{ 0 };
+  void capture_output( rs2::processing_block & block );
+  // Runs block on calling thread and returns its result. rs2::filter::process()
+  // passes results through an internal frame_queue, which allocates per frame.
+  rs2::frame run_filter( rs2::processing_block & block, const rs2::frame & frame );
+
+  // rows of output composited per tile
+  static const size_t TILE_ROWS = 16;
+  parallel_tiles * tiles{ nullptr };
+  // what tiles of the current frame read and write
+  struct composite_job
+  {
+    obs_frame_processor * processor;
+    const uint8_t * rgb_data;
+    size_t rgb_stride;
+    rs2_format color_format;
+    const uint16_t * depth_data;
+    size_t depth_width;
+    size_t depth_height;
+    size_t depth_stride;
+    // depth_mapping of this frame
+    int mapping;
+    // table for mapping, nullptr with DEPTH_MAP_STEPS
+    const uint32_t * depth_lut;
+    uint8_t * rgba;
+    // where composite_tile writes color and depth row 0, nullptr to skip either
+    uint8_t * color_out;
+    uint8_t * depth_out;
+    size_t row_bytes;
+    uint8_t fill[4];
+  } job;
+  // sets up tiles for current compositing_workers and runs job over rows,
+  // all rows of color unless given
+  void run_tiles( parallel_tiles::tile_function function, size_t rows = 0 );
+  void set_tile_outputs( uint8_t * color_out, uint8_t * depth_out, size_t row_bytes );
+  static void composite_tile( void * context, size_t tile );
+  // keys rows of depth into matte, then composites color with alpha from it
+  static void matte_key_tile( void * context, size_t tile );
+  static void matte_tile( void * context, size_t tile );
+  static void fill_tile( void * context, size_t tile );
+  void prepare_depth_columns( size_t src_pixels, size_t dst_pixels );
+
+  void color_to_rgba( const uint8_t *src, rs2_format format, uint8_t *dst, size_t pixels );
+  void depth_to_rgba( const uint16_t *src, size_t src_pixels, uint8_t *dst, size_t dst_pixels );
 };
@@ -0,0 +1,161 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include "obs_frame_worker.h"
+#include "realsense-device.h"
+#include <obs-module.h>
+#include <iostream>
+using namespace std;
+
+obs_frame_worker::~obs_frame_worker()
+{
+  stop();
+}
+
+void obs_frame_worker::init( size_t width, size_t height, realsense_device *device, int layout )
+{
+  frame_processor.init( width, height, device, layout );
+  total_frames = 0;
+  total_bytes_copied = 0;
+  for ( size_t i = 0; i < output.count; i++ )
+  {
+    output[i].rgba.resize( frame_processor.video_width * frame_processor.video_height * 4 ); // RGBA
+    // room for depth registered to color, so alignment never grows it
+    output[i].aligned_depth.reserve( width * height );
+  }
+}
+
+void obs_frame_worker::start( thread_pool & pool )
+{
+  if ( task != nullptr ) return;
+  running = true;
+  frame_processor.tile_pool = &pool;
+  task = new pool_task( pool, [this]{ process_frames(); } );
+  frame_processor.rs_device->set_consumer( task );
+  // frames may have been queued before consumer was set
+  task->schedule();
+}
+
+void obs_frame_worker::stop()
+{
+  if ( task == nullptr ) return;
+  running = false;
+  frame_processor.rs_device->set_consumer( nullptr );
+  delete task; // waits until idle
+  task = nullptr;
+}
+
+void obs_frame_worker::set_async_output( obs_source * source )
+{
+  async_source = source;
+  frame_processor.pass_yuyv = source != nullptr;
+}
+
+double obs_frame_worker::average_bytes_copied() const
+{
+  uint64_t frames = total_frames;
+  return frames ? (double)total_bytes_copied / frames : 0.0;
+}
+
+const obs_frame_output * obs_frame_worker::acquire_latest()
+{
+  if ( !output.acquire() ) return nullptr;
+  return &output.read_buffer();
+}
+
+void obs_frame_worker::process_frames()
+{
+  realsense_device * dev = frame_processor.rs_device;
+  rs2::frameset frames;
+  while ( running && dev->get_frame( frames ) )
+  {
+    int64_t now = stats_now_ns();
+    int64_t received_ns = dev->stats.frame_dequeued( frames.get_frame_number(), now );
+    if ( skip_while_idle( now ) ) continue;
+    obs_frame_output & out = output.write_buffer();
+    out.received_ns = received_ns;
+    try
+    {
+      if ( frame_processor.update_context( frames, &dev->align_to, out ) )
+      {
+        total_frames++;
+        count_copied( out.bytes_copied );
+        dev->stats.frame_processed( frame_processor.stage_us );
+        dev->stats.frame_published();
+        out.published_ns = stats_now_ns();
+        if ( async_source ) output_async();
+        else                output.publish();
+      }
+    }
+    catch ( rs2::error & e )
+    {
+      cerr << "RealSense error calling " << e.get_failed_function() << "(" << e.get_failed_args() << "):\n    " << e.what() << endl;
+    }
+    catch ( std::exception & e )
+    {
+      // runs on a shared pool thread, an escaping exception would take OBS down; only this frame is lost
+      cerr << "Realsense exception " << e.what() << "\n";
+    }
+  }
+}
+
+bool obs_frame_worker::skip_while_idle( int64_t now_ns )
+{
+  realsense_device * dev = frame_processor.rs_device;
+  if ( !dev->idle ) return false;
+  if ( dev->idle_policy == IDLE_THROTTLE &&
+       now_ns - last_idle_frame_ns >= IDLE_THROTTLE_INTERVAL_MS * 1000000LL )
+  {
+    last_idle_frame_ns = now_ns;
+    return false;
+  }
+  // stopping policy drops frames too until streaming stops
+  return true;
+}
+
+void obs_frame_worker::output_async()
+{
+  obs_source_frame frame = {};
+  frame.data[0]     = output.write_buffer().rgba.data();
+  frame.linesize[0] = (uint32_t)(frame_processor.video_width * 4);
+  frame.width       = (uint32_t)frame_processor.video_width;
+  frame.height      = (uint32_t)frame_processor.video_height;
+  frame.format      = VIDEO_FORMAT_RGBA;
+  frame.full_range  = true;
+  if ( output.write_buffer().color_frame )
+  {
+    // YUYV straight from camera, OBS converts it while uploading
+    rs2::video_frame color = output.write_buffer().color_frame;
+    frame.data[0]     = (uint8_t *)color.get_data();
+    frame.linesize[0] = (uint32_t)color.get_stride_in_bytes();
+    frame.format      = VIDEO_FORMAT_YUY2;
+    frame.full_range  = false;
+    video_format_get_parameters( VIDEO_CS_601, VIDEO_RANGE_PARTIAL, frame.color_matrix,
+                                 frame.color_range_min, frame.color_range_max );
+  }
+  // device timestamps are in milliseconds
+  frame.timestamp   = (uint64_t)(output.write_buffer().timestamp * 1000000.0);
+  // OBS copies the frame, so write buffer can be reused right away
+  int64_t upload_start = stats_now_ns();
+  obs_source_output_video( async_source, &frame );
+  frame_processor.rs_device->stats.frame_shown( output.write_buffer().received_ns, 0,
+                                                upload_start, stats_now_ns() );
+  count_copied( frame.linesize[0] * frame.height );
+}
@@ -0,0 +1,71 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <vector>
+#include <thread>
+#include <atomic>
+#include "obs_frame_processor.h"
+#include "triple_buffer.h"
+#include "thread_pool.h"
+
+class realsense_device;
+struct obs_source;
+
+// Runs depth filtering and compositing as a task on the shared thread pool
+// whenever the device queues a frameset, so that OBS video tick only needs
+// to upload the latest finished image.
+class obs_frame_worker
+{
+public:
+  obs_frame_processor frame_processor;
+
+  virtual ~obs_frame_worker();
+  // width and height of color stream, see obs_frame_processor::init
+  void init( size_t width, size_t height, realsense_device *device, int layout = LAYOUT_SIDE_BY_SIDE );
+  void start( thread_pool & pool );
+  // returns after any frame being processed is finished
+  void stop();
+  // Frames are passed to source with obs_source_output_video instead of
+  // publishing them for acquire_latest(). Set before start().
+  void set_async_output( obs_source * source );
+  // Returns newest finished frame, or nullptr if none was completed since previous call.
+  const obs_frame_output * acquire_latest();
+  // Consumer reports bytes it copied for the frame, e.g. texture uploads.
+  void count_copied( size_t bytes ) { total_bytes_copied += bytes; }
+  // average CPU-side bytes copied per processed frame since init
+  double average_bytes_copied() const;
+protected:
+  std::atomic<uint64_t> total_frames {0};
+  std::atomic<uint64_t> total_bytes_copied {0};
+
+  triple_buffer<obs_frame_output> output;
+  obs_source * async_source {nullptr};
+  pool_task * task {nullptr};
+  std::atomic_bool running {false};
+
+  // when latest frameset was processed while device was idle
+  int64_t last_idle_frame_ns {0};
+
+  // processes framesets until device has none queued
+  void process_frames();
+  // true if frameset dequeued at now_ns is dropped due to device idle_policy
+  bool skip_while_idle( int64_t now_ns );
+  void output_async();
+};
@@ -0,0 +1,153 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include "pixel_kernels.h"
+#include <cstring>
+#if defined(PIXEL_KERNELS_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(PIXEL_KERNELS_X86)
+#include <cpuid.h>
+#endif
+using namespace std;
+
+static void rgb_to_rgba_scalar( const uint8_t *src, uint8_t *dst, size_t pixels )
+{
+  for ( size_t i = 0; i < pixels; i++ )
+  {
+    dst[i*4    ] = src[i*3];
+    dst[i*4 + 1] = src[i*3 + 1];
+    dst[i*4 + 2] = src[i*3 + 2];
+    dst[i*4 + 3] = 255; // alpha
+  }
+}
+
+static void yuyv_to_rgba_scalar( const uint8_t *src, uint8_t *dst, size_t pixels )
+{
+  for ( size_t i = 0; i < pixels; i++ )
+  {
+    // each pair of pixels is Y0 U Y1 V
+    const uint8_t *pair = src + (i / 2) * 4;
+    uint32_t value = yuyv_to_rgba_value( pair[(i & 1) * 2], pair[1], pair[3] );
+    memcpy( dst + i * 4, &value, 4 );
+  }
+}
+
+static void depth_to_gray_scalar( const uint16_t *src, uint8_t *dst, size_t dst_pixels,
+                                  uint16_t clamp_min, bool upsample2x )
+{
+  for ( size_t i = 0; i < dst_pixels; i++ )
+  {
+    uint8_t dval = depth_to_gray_value( src[upsample2x ? i / 2 : i], clamp_min );
+    dst[i*4    ] = dval;
+    dst[i*4 + 1] = dval;
+    dst[i*4 + 2] = dval;
+    dst[i*4 + 3] = 255; // alpha
+  }
+}
+
+void depth_lookup_scalar( const uint16_t *src, const uint32_t *lut, uint8_t *dst,
+                          size_t dst_pixels, bool upsample2x )
+{
+  for ( size_t i = 0; i < dst_pixels; i++ )
+  {
+    memcpy( dst + i * 4, lut + src[upsample2x ? i / 2 : i], 4 );
+  }
+}
+
+static void depth_pack_scalar( const uint16_t *src, uint8_t *dst, size_t dst_pixels, bool upsample2x )
+{
+  for ( size_t i = 0; i < dst_pixels; i++ )
+  {
+    uint32_t value = depth_pack_value( src[upsample2x ? i / 2 : i] );
+    memcpy( dst + i * 4, &value, 4 );
+  }
+}
+
+const pixel_kernels & scalar_pixel_kernels()
+{
+  static const pixel_kernels kernels = { "scalar", rgb_to_rgba_scalar, yuyv_to_rgba_scalar, depth_to_gray_scalar,
+                                         depth_lookup_scalar, depth_pack_scalar };
+  return kernels;
+}
+
+#if defined(PIXEL_KERNELS_X86)
+static void cpuid( int leaf, int subleaf, int regs[4] )
+{
+#if defined(_MSC_VER)
+  __cpuidex( regs, leaf, subleaf );
+#else
+  unsigned int a, b, c, d;
+  __cpuid_count( leaf, subleaf, a, b, c, d );
+  regs[0] = (int)a; regs[1] = (int)b; regs[2] = (int)c; regs[3] = (int)d;
+#endif
+}
+
+static uint64_t read_xcr0()
+{
+#if defined(_MSC_VER)
+  return _xgetbv(0);
+#else
+  uint32_t eax, edx;
+  __asm__ __volatile__( "xgetbv" : "=a"(eax), "=d"(edx) : "c"(0) );
+  return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+vector<const pixel_kernels *> supported_pixel_kernels()
+{
+  int regs[4];
+  cpuid( 0, 0, regs );
+  int max_leaf = regs[0];
+  cpuid( 1, 0, regs );
+  bool sse41   = (regs[2] & (1 << 19)) != 0;
+  bool osxsave = (regs[2] & (1 << 27)) != 0;
+  bool avx     = (regs[2] & (1 << 28)) != 0;
+  bool avx2    = false;
+  // AVX state must also be enabled by the operating system
+  if ( max_leaf >= 7 && osxsave && avx && (read_xcr0() & 0x6) == 0x6 )
+  {
+    cpuid( 7, 0, regs );
+    avx2 = (regs[1] & (1 << 5)) != 0;
+  }
+  vector<const pixel_kernels *> supported( 1, &scalar_pixel_kernels() );
+  if ( sse41 ) supported.push_back( &sse41_pixel_kernels );
+  if ( avx2 )  supported.push_back( &avx2_pixel_kernels );
+  return supported;
+}
+#elif defined(PIXEL_KERNELS_NEON)
+vector<const pixel_kernels *> supported_pixel_kernels()
+{
+  // NEON is mandatory on 64-bit ARM
+  vector<const pixel_kernels *> supported( 1, &scalar_pixel_kernels() );
+  supported.push_back( &neon_pixel_kernels );
+  return supported;
+}
+#else
+vector<const pixel_kernels *> supported_pixel_kernels()
+{
+  return vector<const pixel_kernels *>( 1, &scalar_pixel_kernels() );
+}
+#endif
+
+const pixel_kernels & get_pixel_kernels()
+{
+  static const pixel_kernels & kernels = *supported_pixel_kernels().back();
+  return kernels;
+}
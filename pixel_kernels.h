@@ -0,0 +1,113 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// Depth values are quantized to 8-bit gray in steps of this many depth units.
+const uint16_t DEPTH_GRAY_STEP = 100;
+
+// Converts one row of RGB8 pixels into RGBA8 with opaque alpha.
+typedef void (*rgb_to_rgba_row_func)( const uint8_t *src, uint8_t *dst, size_t pixels );
+
+// Converts one row of YUYV (YUY2) pixels into RGBA8 with opaque alpha, using
+// the same BT.601 limited range integer formula librealsense uses for RGB8,
+// so output does not depend on which format was streamed. Odd pixel counts
+// read the last pair and write only its first pixel.
+typedef void (*yuyv_to_rgba_row_func)( const uint8_t *src, uint8_t *dst, size_t pixels );
+
+// Converts one row of Z16 depth into 8-bit gray RGBA pixels. Depth below clamp_min
+// and values not fitting into 8 bits after quantization become zero. With upsample2x
+// each source pixel is written twice, so only (dst_pixels+1)/2 source values are read.
+typedef void (*depth_to_gray_row_func)( const uint16_t *src, uint8_t *dst, size_t dst_pixels,
+                                        uint16_t clamp_min, bool upsample2x );
+
+// Converts one row of Z16 depth into RGBA pixels by looking each value up
+// in a 65536-entry table of RGBA pixels, see depth_lut.h. upsample2x works
+// as with depth_to_gray.
+typedef void (*depth_lookup_row_func)( const uint16_t *src, const uint32_t *lut, uint8_t *dst,
+                                       size_t dst_pixels, bool upsample2x );
+
+// Converts one row of Z16 depth into RGBA pixels keeping all 16 bits: high
+// byte in red, low byte in green, blue zero and alpha opaque. upsample2x
+// works as with depth_to_gray.
+typedef void (*depth_pack_row_func)( const uint16_t *src, uint8_t *dst, size_t dst_pixels,
+                                     bool upsample2x );
+
+struct pixel_kernels
+{
+  const char *name;
+  rgb_to_rgba_row_func rgb_to_rgba;
+  yuyv_to_rgba_row_func yuyv_to_rgba;
+  depth_to_gray_row_func depth_to_gray;
+  depth_lookup_row_func depth_lookup;
+  depth_pack_row_func depth_pack;
+};
+
+// Plain C++ reference implementation, available on every platform.
+const pixel_kernels & scalar_pixel_kernels();
+// Table lookup is bound by memory rather than arithmetic, so implementations
+// without a gather instruction share this one.
+void depth_lookup_scalar( const uint16_t *src, const uint32_t *lut, uint8_t *dst,
+                          size_t dst_pixels, bool upsample2x );
+// Packs single depth value exactly as depth_pack does.
+inline uint32_t depth_pack_value( uint16_t depth )
+{
+  const uint8_t bytes[4] = { (uint8_t)(depth >> 8), (uint8_t)(depth & 0xFF), 0, 255 };
+  uint32_t value;
+  memcpy( &value, bytes, sizeof(value) );
+  return value;
+}
+// Converts single YUYV pixel exactly as yuyv_to_rgba does.
+inline uint32_t yuyv_to_rgba_value( uint8_t y, uint8_t u, uint8_t v )
+{
+  const int c = y - 16, d = u - 128, e = v - 128;
+  const int r = (298 * c + 409 * e + 128) >> 8;
+  const int g = (298 * c - 100 * d - 208 * e + 128) >> 8;
+  const int b = (298 * c + 516 * d + 128) >> 8;
+  const uint8_t bytes[4] = { (uint8_t)(r < 0 ? 0 : r > 255 ? 255 : r),
+                             (uint8_t)(g < 0 ? 0 : g > 255 ? 255 : g),
+                             (uint8_t)(b < 0 ? 0 : b > 255 ? 255 : b), 255 };
+  uint32_t value;
+  memcpy( &value, bytes, sizeof(value) );
+  return value;
+}
+// Fastest implementation supported by the running CPU, selected on first call.
+const pixel_kernels & get_pixel_kernels();
+// Every implementation running CPU supports, scalar first and fastest last.
+std::vector<const pixel_kernels *> supported_pixel_kernels();
+
+// Quantizes single depth value exactly as the reference implementation does.
+inline uint8_t depth_to_gray_value( uint16_t depth, uint16_t clamp_min )
+{
+  if ( depth < clamp_min ) return 0;
+  uint16_t dval16 = (uint16_t)((depth - clamp_min) / DEPTH_GRAY_STEP);
+  return dval16 > 255 ? 0 : (uint8_t)dval16;
+}
+
+#if defined(PIXEL_KERNELS_X86)
+extern const pixel_kernels sse41_pixel_kernels;
+extern const pixel_kernels avx2_pixel_kernels;
+#endif
+#if defined(PIXEL_KERNELS_NEON)
+extern const pixel_kernels neon_pixel_kernels;
+#endif
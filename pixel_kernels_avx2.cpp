@@ -0,0 +1,214 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+// Compiled with AVX2 enabled, only called after runtime CPU check.
+#include "pixel_kernels.h"
+#include <immintrin.h>
+
+static void rgb_to_rgba_avx2( const uint8_t *src, uint8_t *dst, size_t pixels )
+{
+  // byte shuffles work per 128-bit lane, so each lane gets four packed RGB pixels
+  const __m256i spread = _mm256_setr_epi8( 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                           0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1 );
+  const __m256i alpha  = _mm256_set1_epi32( (int)0xFF000000 );
+  size_t i = 0;
+  // upper lane load reads four bytes past the eight pixels, keep it inside the row
+  for ( ; i + 32 + 2 <= pixels; i += 32 )
+  {
+    const uint8_t *s = src + i * 3;
+    __m256i *d = (__m256i *)(dst + i * 4);
+    for ( int k = 0; k < 4; k++, s += 24 )
+    {
+      __m256i in = _mm256_inserti128_si256( _mm256_castsi128_si256( _mm_loadu_si128( (const __m128i *)s ) ),
+                                            _mm_loadu_si128( (const __m128i *)(s + 12) ), 1 );
+      _mm256_storeu_si256( d + k, _mm256_or_si256( _mm256_shuffle_epi8( in, spread ), alpha ) );
+    }
+  }
+  scalar_pixel_kernels().rgb_to_rgba( src + i * 3, dst + i * 4, pixels - i );
+}
+
+// YUYV to RGBA as in pixel_kernels_sse41.cpp, in both lanes at once: lane 0
+// converts pixels 0-7 and lane 1 pixels 8-15.
+static void yuyv_to_rgba_avx2( const uint8_t *src, uint8_t *dst, size_t pixels )
+{
+  const __m256i y_of  = _mm256_setr_epi8( 0, -1, 2, -1, 4, -1, 6, -1, 8, -1, 10, -1, 12, -1, 14, -1,
+                                          0, -1, 2, -1, 4, -1, 6, -1, 8, -1, 10, -1, 12, -1, 14, -1 );
+  const __m256i u_of  = _mm256_setr_epi8( 1, -1, 1, -1, 5, -1, 5, -1, 9, -1, 9, -1, 13, -1, 13, -1,
+                                          1, -1, 1, -1, 5, -1, 5, -1, 9, -1, 9, -1, 13, -1, 13, -1 );
+  const __m256i v_of  = _mm256_setr_epi8( 3, -1, 3, -1, 7, -1, 7, -1, 11, -1, 11, -1, 15, -1, 15, -1,
+                                          3, -1, 3, -1, 7, -1, 7, -1, 11, -1, 11, -1, 15, -1, 15, -1 );
+  const __m256i r_ce  = _mm256_set1_epi32( (409 << 16) | 298 );
+  const __m256i g_cd  = _mm256_set1_epi32( (int)(((uint32_t)(uint16_t)-100 << 16) | 298) );
+  const __m256i g_e1  = _mm256_set1_epi32( (128 << 16) | (uint16_t)-208 );
+  const __m256i b_cd  = _mm256_set1_epi32( (516 << 16) | 298 );
+  const __m256i round = _mm256_set1_epi32( 128 );
+  const __m256i one   = _mm256_set1_epi16( 1 );
+  const __m256i alpha = _mm256_set1_epi16( 255 );
+  size_t i = 0;
+  for ( ; i + 16 <= pixels; i += 16 )
+  {
+    __m256i yuyv = _mm256_loadu_si256( (const __m256i *)(src + i * 2) );
+    __m256i c = _mm256_sub_epi16( _mm256_shuffle_epi8( yuyv, y_of ), _mm256_set1_epi16( 16 ) );
+    __m256i d = _mm256_sub_epi16( _mm256_shuffle_epi8( yuyv, u_of ), _mm256_set1_epi16( 128 ) );
+    __m256i e = _mm256_sub_epi16( _mm256_shuffle_epi8( yuyv, v_of ), _mm256_set1_epi16( 128 ) );
+    __m256i ce_lo = _mm256_unpacklo_epi16( c, e ), ce_hi = _mm256_unpackhi_epi16( c, e );
+    __m256i cd_lo = _mm256_unpacklo_epi16( c, d ), cd_hi = _mm256_unpackhi_epi16( c, d );
+    __m256i e1_lo = _mm256_unpacklo_epi16( e, one ), e1_hi = _mm256_unpackhi_epi16( e, one );
+    __m256i r = _mm256_packs_epi32(
+      _mm256_srai_epi32( _mm256_add_epi32( _mm256_madd_epi16( ce_lo, r_ce ), round ), 8 ),
+      _mm256_srai_epi32( _mm256_add_epi32( _mm256_madd_epi16( ce_hi, r_ce ), round ), 8 ) );
+    __m256i g = _mm256_packs_epi32(
+      _mm256_srai_epi32( _mm256_add_epi32( _mm256_madd_epi16( cd_lo, g_cd ), _mm256_madd_epi16( e1_lo, g_e1 ) ), 8 ),
+      _mm256_srai_epi32( _mm256_add_epi32( _mm256_madd_epi16( cd_hi, g_cd ), _mm256_madd_epi16( e1_hi, g_e1 ) ), 8 ) );
+    __m256i b = _mm256_packs_epi32(
+      _mm256_srai_epi32( _mm256_add_epi32( _mm256_madd_epi16( cd_lo, b_cd ), round ), 8 ),
+      _mm256_srai_epi32( _mm256_add_epi32( _mm256_madd_epi16( cd_hi, b_cd ), round ), 8 ) );
+    __m256i rg = _mm256_packus_epi16( r, g );
+    __m256i ba = _mm256_packus_epi16( b, alpha );
+    __m256i rg_pairs = _mm256_unpacklo_epi8( rg, _mm256_srli_si256( rg, 8 ) );
+    __m256i ba_pairs = _mm256_unpacklo_epi8( ba, _mm256_srli_si256( ba, 8 ) );
+    __m256i lo = _mm256_unpacklo_epi16( rg_pairs, ba_pairs );
+    __m256i hi = _mm256_unpackhi_epi16( rg_pairs, ba_pairs );
+    __m256i *d_out = (__m256i *)(dst + i * 4);
+    _mm256_storeu_si256( d_out,     _mm256_permute2x128_si256( lo, hi, 0x20 ) );
+    _mm256_storeu_si256( d_out + 1, _mm256_permute2x128_si256( lo, hi, 0x31 ) );
+  }
+  scalar_pixel_kernels().yuyv_to_rgba( src + i * 2, dst + i * 4, pixels - i );
+}
+
+// Quantizes sixteen depth values, lane 0 low bytes hold values 0-7, lane 1 low bytes 8-15.
+static inline __m256i quantize_depth16( __m256i depth, __m256i clamp_min )
+{
+  // see pixel_kernels_sse41.cpp for the arithmetic
+  __m256i diff = _mm256_subs_epu16( depth, clamp_min );
+  __m256i q = _mm256_srli_epi16( _mm256_mulhi_epu16( _mm256_srli_epi16( diff, 2 ), _mm256_set1_epi16( 5243 ) ), 1 );
+  __m256i over = _mm256_cmpgt_epi16( q, _mm256_set1_epi16( 255 ) );
+  q = _mm256_andnot_si256( over, q );
+  return _mm256_packus_epi16( q, q );
+}
+
+static void depth_to_gray_avx2( const uint16_t *src, uint8_t *dst, size_t dst_pixels,
+                                uint16_t clamp_min, bool upsample2x )
+{
+  const __m256i minv  = _mm256_set1_epi16( (short)clamp_min );
+  const __m256i alpha = _mm256_set1_epi32( (int)0xFF000000 );
+  size_t i = 0;
+  __m256i *d = (__m256i *)dst;
+  if ( upsample2x )
+  {
+    // gray value of each pixel repeated into RGB of two adjacent pixels
+    const __m256i spread_lo = _mm256_setr_epi8( 0, 0, 0, -1, 0, 0, 0, -1, 1, 1, 1, -1, 1, 1, 1, -1,
+                                                2, 2, 2, -1, 2, 2, 2, -1, 3, 3, 3, -1, 3, 3, 3, -1 );
+    const __m256i spread_hi = _mm256_setr_epi8( 4, 4, 4, -1, 4, 4, 4, -1, 5, 5, 5, -1, 5, 5, 5, -1,
+                                                6, 6, 6, -1, 6, 6, 6, -1, 7, 7, 7, -1, 7, 7, 7, -1 );
+    // 16 source values produce 32 output pixels
+    for ( ; i + 32 <= dst_pixels; i += 32, d += 4 )
+    {
+      __m256i q8 = quantize_depth16( _mm256_loadu_si256( (const __m256i *)(src + i / 2) ), minv );
+      __m256i a = _mm256_permute4x64_epi64( q8, 0x00 ); // values 0-7 in both lanes
+      __m256i b = _mm256_permute4x64_epi64( q8, 0xAA ); // values 8-15 in both lanes
+      _mm256_storeu_si256( d,     _mm256_or_si256( _mm256_shuffle_epi8( a, spread_lo ), alpha ) );
+      _mm256_storeu_si256( d + 1, _mm256_or_si256( _mm256_shuffle_epi8( a, spread_hi ), alpha ) );
+      _mm256_storeu_si256( d + 2, _mm256_or_si256( _mm256_shuffle_epi8( b, spread_lo ), alpha ) );
+      _mm256_storeu_si256( d + 3, _mm256_or_si256( _mm256_shuffle_epi8( b, spread_hi ), alpha ) );
+    }
+    scalar_pixel_kernels().depth_to_gray( src + i / 2, dst + i * 4, dst_pixels - i, clamp_min, true );
+  }
+  else
+  {
+    const __m256i spread = _mm256_setr_epi8( 0, 0, 0, -1, 1, 1, 1, -1, 2, 2, 2, -1, 3, 3, 3, -1,
+                                             4, 4, 4, -1, 5, 5, 5, -1, 6, 6, 6, -1, 7, 7, 7, -1 );
+    for ( ; i + 16 <= dst_pixels; i += 16, d += 2 )
+    {
+      __m256i q8 = quantize_depth16( _mm256_loadu_si256( (const __m256i *)(src + i) ), minv );
+      __m256i a = _mm256_permute4x64_epi64( q8, 0x00 );
+      __m256i b = _mm256_permute4x64_epi64( q8, 0xAA );
+      _mm256_storeu_si256( d,     _mm256_or_si256( _mm256_shuffle_epi8( a, spread ), alpha ) );
+      _mm256_storeu_si256( d + 1, _mm256_or_si256( _mm256_shuffle_epi8( b, spread ), alpha ) );
+    }
+    scalar_pixel_kernels().depth_to_gray( src + i, dst + i * 4, dst_pixels - i, clamp_min, false );
+  }
+}
+
+static void depth_lookup_avx2( const uint16_t *src, const uint32_t *lut, uint8_t *dst,
+                               size_t dst_pixels, bool upsample2x )
+{
+  size_t i = 0;
+  __m256i *d = (__m256i *)dst;
+  if ( upsample2x )
+  {
+    // 8 source values produce 16 output pixels
+    for ( ; i + 16 <= dst_pixels; i += 16, d += 2 )
+    {
+      __m256i index = _mm256_cvtepu16_epi32( _mm_loadu_si128( (const __m128i *)(src + i / 2) ) );
+      __m256i px = _mm256_i32gather_epi32( (const int *)lut, index, 4 );
+      __m256i lo = _mm256_unpacklo_epi32( px, px ); // 0 0 1 1 | 4 4 5 5
+      __m256i hi = _mm256_unpackhi_epi32( px, px ); // 2 2 3 3 | 6 6 7 7
+      _mm256_storeu_si256( d,     _mm256_permute2x128_si256( lo, hi, 0x20 ) );
+      _mm256_storeu_si256( d + 1, _mm256_permute2x128_si256( lo, hi, 0x31 ) );
+    }
+    depth_lookup_scalar( src + i / 2, lut, dst + i * 4, dst_pixels - i, true );
+  }
+  else
+  {
+    for ( ; i + 8 <= dst_pixels; i += 8, d++ )
+    {
+      __m256i index = _mm256_cvtepu16_epi32( _mm_loadu_si128( (const __m128i *)(src + i) ) );
+      _mm256_storeu_si256( d, _mm256_i32gather_epi32( (const int *)lut, index, 4 ) );
+    }
+    depth_lookup_scalar( src + i, lut, dst + i * 4, dst_pixels - i, false );
+  }
+}
+
+static void depth_pack_avx2( const uint16_t *src, uint8_t *dst, size_t dst_pixels, bool upsample2x )
+{
+  // after widening each pixel holds its depth in low two bytes, swap them
+  // into red and green
+  const __m256i swap = _mm256_setr_epi8( 1, 0, -1, -1, 5, 4, -1, -1, 9, 8, -1, -1, 13, 12, -1, -1,
+                                         1, 0, -1, -1, 5, 4, -1, -1, 9, 8, -1, -1, 13, 12, -1, -1 );
+  const __m256i alpha = _mm256_set1_epi32( (int)0xFF000000 );
+  size_t i = 0;
+  __m256i *d = (__m256i *)dst;
+  if ( upsample2x )
+  {
+    for ( ; i + 16 <= dst_pixels; i += 16, d += 2 )
+    {
+      __m256i depth = _mm256_cvtepu16_epi32( _mm_loadu_si128( (const __m128i *)(src + i / 2) ) );
+      __m256i px = _mm256_or_si256( _mm256_shuffle_epi8( depth, swap ), alpha );
+      __m256i lo = _mm256_unpacklo_epi32( px, px );
+      __m256i hi = _mm256_unpackhi_epi32( px, px );
+      _mm256_storeu_si256( d,     _mm256_permute2x128_si256( lo, hi, 0x20 ) );
+      _mm256_storeu_si256( d + 1, _mm256_permute2x128_si256( lo, hi, 0x31 ) );
+    }
+    scalar_pixel_kernels().depth_pack( src + i / 2, dst + i * 4, dst_pixels - i, true );
+  }
+  else
+  {
+    for ( ; i + 8 <= dst_pixels; i += 8, d++ )
+    {
+      __m256i depth = _mm256_cvtepu16_epi32( _mm_loadu_si128( (const __m128i *)(src + i) ) );
+      _mm256_storeu_si256( d, _mm256_or_si256( _mm256_shuffle_epi8( depth, swap ), alpha ) );
+    }
+    scalar_pixel_kernels().depth_pack( src + i, dst + i * 4, dst_pixels - i, false );
+  }
+}
+
+extern const pixel_kernels avx2_pixel_kernels = { "AVX2", rgb_to_rgba_avx2, yuyv_to_rgba_avx2,
+                                                  depth_to_gray_avx2, depth_lookup_avx2, depth_pack_avx2 };
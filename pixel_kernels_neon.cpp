@@ -0,0 +1,166 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include "pixel_kernels.h"
+#include <arm_neon.h>
+
+static void rgb_to_rgba_neon( const uint8_t *src, uint8_t *dst, size_t pixels )
+{
+  size_t i = 0;
+  uint8x16x4_t rgba;
+  rgba.val[3] = vdupq_n_u8( 255 );
+  for ( ; i + 16 <= pixels; i += 16 )
+  {
+    uint8x16x3_t rgb = vld3q_u8( src + i * 3 );
+    rgba.val[0] = rgb.val[0];
+    rgba.val[1] = rgb.val[1];
+    rgba.val[2] = rgb.val[2];
+    vst4q_u8( dst + i * 4, rgba );
+  }
+  scalar_pixel_kernels().rgb_to_rgba( src + i * 3, dst + i * 4, pixels - i );
+}
+
+// One channel of eight pixels from 16-bit c and chroma terms, products are
+// summed in 32 bits and narrowed with saturation like yuyv_to_rgba_value.
+static inline uint8x8_t yuv_channel( int16x8_t c, int16x8_t t0, int16_t k0, int16x8_t t1, int16_t k1 )
+{
+  int32x4_t lo = vdupq_n_s32( 128 ), hi = vdupq_n_s32( 128 );
+  lo = vmlal_n_s16( lo, vget_low_s16( c ), 298 );
+  hi = vmlal_n_s16( hi, vget_high_s16( c ), 298 );
+  lo = vmlal_n_s16( lo, vget_low_s16( t0 ), k0 );
+  hi = vmlal_n_s16( hi, vget_high_s16( t0 ), k0 );
+  lo = vmlal_n_s16( lo, vget_low_s16( t1 ), k1 );
+  hi = vmlal_n_s16( hi, vget_high_s16( t1 ), k1 );
+  // negative sums become zero here, sums over 255 in vqmovn
+  return vqmovn_u16( vcombine_u16( vqshrun_n_s32( lo, 8 ), vqshrun_n_s32( hi, 8 ) ) );
+}
+
+static void yuyv_to_rgba_neon( const uint8_t *src, uint8_t *dst, size_t pixels )
+{
+  uint8x8x4_t rgba;
+  rgba.val[3] = vdup_n_u8( 255 );
+  size_t i = 0;
+  for ( ; i + 16 <= pixels; i += 16 )
+  {
+    // eight pairs: even and odd pixel luma, shared chroma
+    uint8x8x4_t yuyv = vld4_u8( src + i * 2 );
+    int16x8_t d = vreinterpretq_s16_u16( vsubl_u8( yuyv.val[1], vdup_n_u8( 128 ) ) );
+    int16x8_t e = vreinterpretq_s16_u16( vsubl_u8( yuyv.val[3], vdup_n_u8( 128 ) ) );
+    uint8x8_t r[2], g[2], b[2];
+    for ( int k = 0; k < 2; k++ )
+    {
+      int16x8_t c = vreinterpretq_s16_u16( vsubl_u8( yuyv.val[k * 2], vdup_n_u8( 16 ) ) );
+      r[k] = yuv_channel( c, e, 409, d, 0 );
+      g[k] = yuv_channel( c, d, -100, e, -208 );
+      b[k] = yuv_channel( c, d, 516, e, 0 );
+    }
+    uint8x8x2_t rs = vzip_u8( r[0], r[1] ), gs = vzip_u8( g[0], g[1] ), bs = vzip_u8( b[0], b[1] );
+    for ( int k = 0; k < 2; k++ )
+    {
+      rgba.val[0] = rs.val[k];
+      rgba.val[1] = gs.val[k];
+      rgba.val[2] = bs.val[k];
+      vst4_u8( dst + i * 4 + k * 32, rgba );
+    }
+  }
+  scalar_pixel_kernels().yuyv_to_rgba( src + i * 2, dst + i * 4, pixels - i );
+}
+
+// Quantizes eight depth values, see pixel_kernels_sse41.cpp for the arithmetic.
+static inline uint8x8_t quantize_depth8( uint16x8_t depth, uint16x8_t clamp_min )
+{
+  uint16x8_t diff = vshrq_n_u16( vqsubq_u16( depth, clamp_min ), 2 );
+  const uint16x4_t mul = vdup_n_u16( 5243 );
+  uint32x4_t lo = vmull_u16( vget_low_u16( diff ), mul );
+  uint32x4_t hi = vmull_u16( vget_high_u16( diff ), mul );
+  uint16x8_t q = vshrq_n_u16( vcombine_u16( vshrn_n_u32( lo, 16 ), vshrn_n_u32( hi, 16 ) ), 1 );
+  q = vbicq_u16( q, vcgtq_u16( q, vdupq_n_u16( 255 ) ) );
+  return vmovn_u16( q );
+}
+
+static void depth_to_gray_neon( const uint16_t *src, uint8_t *dst, size_t dst_pixels,
+                                uint16_t clamp_min, bool upsample2x )
+{
+  const uint16x8_t minv = vdupq_n_u16( clamp_min );
+  uint8x8x4_t rgba;
+  rgba.val[3] = vdup_n_u8( 255 );
+  size_t i = 0;
+  if ( upsample2x )
+  {
+    for ( ; i + 16 <= dst_pixels; i += 16 )
+    {
+      uint8x8_t q8 = quantize_depth8( vld1q_u16( src + i / 2 ), minv );
+      uint8x8x2_t twice = vzip_u8( q8, q8 );
+      rgba.val[0] = rgba.val[1] = rgba.val[2] = twice.val[0];
+      vst4_u8( dst + i * 4, rgba );
+      rgba.val[0] = rgba.val[1] = rgba.val[2] = twice.val[1];
+      vst4_u8( dst + i * 4 + 32, rgba );
+    }
+    scalar_pixel_kernels().depth_to_gray( src + i / 2, dst + i * 4, dst_pixels - i, clamp_min, true );
+  }
+  else
+  {
+    for ( ; i + 8 <= dst_pixels; i += 8 )
+    {
+      uint8x8_t q8 = quantize_depth8( vld1q_u16( src + i ), minv );
+      rgba.val[0] = rgba.val[1] = rgba.val[2] = q8;
+      vst4_u8( dst + i * 4, rgba );
+    }
+    scalar_pixel_kernels().depth_to_gray( src + i, dst + i * 4, dst_pixels - i, clamp_min, false );
+  }
+}
+
+static void depth_pack_neon( const uint16_t *src, uint8_t *dst, size_t dst_pixels, bool upsample2x )
+{
+  uint8x8x4_t rgba;
+  rgba.val[2] = vdup_n_u8( 0 );
+  rgba.val[3] = vdup_n_u8( 255 );
+  size_t i = 0;
+  if ( upsample2x )
+  {
+    for ( ; i + 16 <= dst_pixels; i += 16 )
+    {
+      uint16x8_t depth = vld1q_u16( src + i / 2 );
+      uint8x8x2_t high = vzip_u8( vshrn_n_u16( depth, 8 ), vshrn_n_u16( depth, 8 ) );
+      uint8x8x2_t low = vzip_u8( vmovn_u16( depth ), vmovn_u16( depth ) );
+      rgba.val[0] = high.val[0];
+      rgba.val[1] = low.val[0];
+      vst4_u8( dst + i * 4, rgba );
+      rgba.val[0] = high.val[1];
+      rgba.val[1] = low.val[1];
+      vst4_u8( dst + i * 4 + 32, rgba );
+    }
+    scalar_pixel_kernels().depth_pack( src + i / 2, dst + i * 4, dst_pixels - i, true );
+  }
+  else
+  {
+    for ( ; i + 8 <= dst_pixels; i += 8 )
+    {
+      uint16x8_t depth = vld1q_u16( src + i );
+      rgba.val[0] = vshrn_n_u16( depth, 8 );
+      rgba.val[1] = vmovn_u16( depth );
+      vst4_u8( dst + i * 4, rgba );
+    }
+    scalar_pixel_kernels().depth_pack( src + i, dst + i * 4, dst_pixels - i, false );
+  }
+}
+
+extern const pixel_kernels neon_pixel_kernels = { "NEON", rgb_to_rgba_neon, yuyv_to_rgba_neon,
+                                                  depth_to_gray_neon, depth_lookup_scalar, depth_pack_neon };
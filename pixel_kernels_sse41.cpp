@@ -0,0 +1,189 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+// Compiled with SSE4.1 enabled, only called after runtime CPU check.
+#include "pixel_kernels.h"
+#include <smmintrin.h>
+
+static void rgb_to_rgba_sse41( const uint8_t *src, uint8_t *dst, size_t pixels )
+{
+  // spreads four packed RGB pixels into RGBA, alpha byte left zero
+  const __m128i spread = _mm_setr_epi8( 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1 );
+  const __m128i alpha  = _mm_set1_epi32( (int)0xFF000000 );
+  size_t i = 0;
+  // 16 pixels are 48 source bytes, three full loads
+  for ( ; i + 16 <= pixels; i += 16 )
+  {
+    const uint8_t *s = src + i * 3;
+    __m128i in0 = _mm_loadu_si128( (const __m128i *)s );
+    __m128i in1 = _mm_loadu_si128( (const __m128i *)(s + 16) );
+    __m128i in2 = _mm_loadu_si128( (const __m128i *)(s + 32) );
+    __m128i p0 = in0;
+    __m128i p1 = _mm_alignr_epi8( in1, in0, 12 );
+    __m128i p2 = _mm_alignr_epi8( in2, in1, 8 );
+    __m128i p3 = _mm_srli_si128( in2, 4 );
+    __m128i *d = (__m128i *)(dst + i * 4);
+    _mm_storeu_si128( d,     _mm_or_si128( _mm_shuffle_epi8( p0, spread ), alpha ) );
+    _mm_storeu_si128( d + 1, _mm_or_si128( _mm_shuffle_epi8( p1, spread ), alpha ) );
+    _mm_storeu_si128( d + 2, _mm_or_si128( _mm_shuffle_epi8( p2, spread ), alpha ) );
+    _mm_storeu_si128( d + 3, _mm_or_si128( _mm_shuffle_epi8( p3, spread ), alpha ) );
+  }
+  scalar_pixel_kernels().rgb_to_rgba( src + i * 3, dst + i * 4, pixels - i );
+}
+
+// Converts eight YUYV pixels to RGBA. Products do not fit 16 bits, so each
+// channel is a sum of madd pairs in 32 bits, the same integer arithmetic as
+// yuyv_to_rgba_value.
+static inline void yuyv8_to_rgba( __m128i yuyv, __m128i & out_lo, __m128i & out_hi )
+{
+  const __m128i y_of  = _mm_setr_epi8( 0, -1, 2, -1, 4, -1, 6, -1, 8, -1, 10, -1, 12, -1, 14, -1 );
+  const __m128i u_of  = _mm_setr_epi8( 1, -1, 1, -1, 5, -1, 5, -1, 9, -1, 9, -1, 13, -1, 13, -1 );
+  const __m128i v_of  = _mm_setr_epi8( 3, -1, 3, -1, 7, -1, 7, -1, 11, -1, 11, -1, 15, -1, 15, -1 );
+  // coefficient pairs for (c, e), (c, d), (e, 1) and (c, d)
+  const __m128i r_ce  = _mm_setr_epi16( 298, 409, 298, 409, 298, 409, 298, 409 );
+  const __m128i g_cd  = _mm_setr_epi16( 298, -100, 298, -100, 298, -100, 298, -100 );
+  const __m128i g_e1  = _mm_setr_epi16( -208, 128, -208, 128, -208, 128, -208, 128 );
+  const __m128i b_cd  = _mm_setr_epi16( 298, 516, 298, 516, 298, 516, 298, 516 );
+  const __m128i round = _mm_set1_epi32( 128 );
+  const __m128i one   = _mm_set1_epi16( 1 );
+  __m128i c = _mm_sub_epi16( _mm_shuffle_epi8( yuyv, y_of ), _mm_set1_epi16( 16 ) );
+  __m128i d = _mm_sub_epi16( _mm_shuffle_epi8( yuyv, u_of ), _mm_set1_epi16( 128 ) );
+  __m128i e = _mm_sub_epi16( _mm_shuffle_epi8( yuyv, v_of ), _mm_set1_epi16( 128 ) );
+  __m128i ce_lo = _mm_unpacklo_epi16( c, e ), ce_hi = _mm_unpackhi_epi16( c, e );
+  __m128i cd_lo = _mm_unpacklo_epi16( c, d ), cd_hi = _mm_unpackhi_epi16( c, d );
+  __m128i e1_lo = _mm_unpacklo_epi16( e, one ), e1_hi = _mm_unpackhi_epi16( e, one );
+  __m128i r = _mm_packs_epi32(
+    _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( ce_lo, r_ce ), round ), 8 ),
+    _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( ce_hi, r_ce ), round ), 8 ) );
+  __m128i g = _mm_packs_epi32(
+    _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( cd_lo, g_cd ), _mm_madd_epi16( e1_lo, g_e1 ) ), 8 ),
+    _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( cd_hi, g_cd ), _mm_madd_epi16( e1_hi, g_e1 ) ), 8 ) );
+  __m128i b = _mm_packs_epi32(
+    _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( cd_lo, b_cd ), round ), 8 ),
+    _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( cd_hi, b_cd ), round ), 8 ) );
+  // saturating packs clamp to [0, 255], then channels are interleaved
+  __m128i rg = _mm_packus_epi16( r, g );
+  __m128i ba = _mm_packus_epi16( b, _mm_set1_epi16( 255 ) );
+  __m128i rg_pairs = _mm_unpacklo_epi8( rg, _mm_srli_si128( rg, 8 ) );
+  __m128i ba_pairs = _mm_unpacklo_epi8( ba, _mm_srli_si128( ba, 8 ) );
+  out_lo = _mm_unpacklo_epi16( rg_pairs, ba_pairs );
+  out_hi = _mm_unpackhi_epi16( rg_pairs, ba_pairs );
+}
+
+static void yuyv_to_rgba_sse41( const uint8_t *src, uint8_t *dst, size_t pixels )
+{
+  size_t i = 0;
+  for ( ; i + 8 <= pixels; i += 8 )
+  {
+    __m128i lo, hi;
+    yuyv8_to_rgba( _mm_loadu_si128( (const __m128i *)(src + i * 2) ), lo, hi );
+    _mm_storeu_si128( (__m128i *)(dst + i * 4), lo );
+    _mm_storeu_si128( (__m128i *)(dst + i * 4 + 16), hi );
+  }
+  scalar_pixel_kernels().yuyv_to_rgba( src + i * 2, dst + i * 4, pixels - i );
+}
+
+// Quantizes eight depth values, result is in low eight bytes.
+static inline __m128i quantize_depth8( __m128i depth, __m128i clamp_min )
+{
+  // saturating subtract maps everything below minimum to zero
+  __m128i diff = _mm_subs_epu16( depth, clamp_min );
+  // exact diff / 100 for all 16-bit values: ((diff >> 2) * 5243) >> 17
+  __m128i q = _mm_srli_epi16( _mm_mulhi_epu16( _mm_srli_epi16( diff, 2 ), _mm_set1_epi16( 5243 ) ), 1 );
+  // values not fitting into 8 bits are marked as zero
+  __m128i over = _mm_cmpgt_epi16( q, _mm_set1_epi16( 255 ) );
+  q = _mm_andnot_si128( over, q );
+  return _mm_packus_epi16( q, q );
+}
+
+static void depth_to_gray_sse41( const uint16_t *src, uint8_t *dst, size_t dst_pixels,
+                                 uint16_t clamp_min, bool upsample2x )
+{
+  const __m128i minv  = _mm_set1_epi16( (short)clamp_min );
+  const __m128i alpha = _mm_set1_epi32( (int)0xFF000000 );
+  size_t i = 0;
+  __m128i *d = (__m128i *)dst;
+  if ( upsample2x )
+  {
+    // 8 source values produce 16 output pixels
+    for ( ; i + 16 <= dst_pixels; i += 16, d += 4 )
+    {
+      __m128i q8   = quantize_depth8( _mm_loadu_si128( (const __m128i *)(src + i / 2) ), minv );
+      __m128i q16  = _mm_unpacklo_epi8( q8, q8 );
+      __m128i lo   = _mm_unpacklo_epi16( q16, q16 );
+      __m128i hi   = _mm_unpackhi_epi16( q16, q16 );
+      _mm_storeu_si128( d,     _mm_or_si128( _mm_unpacklo_epi32( lo, lo ), alpha ) );
+      _mm_storeu_si128( d + 1, _mm_or_si128( _mm_unpackhi_epi32( lo, lo ), alpha ) );
+      _mm_storeu_si128( d + 2, _mm_or_si128( _mm_unpacklo_epi32( hi, hi ), alpha ) );
+      _mm_storeu_si128( d + 3, _mm_or_si128( _mm_unpackhi_epi32( hi, hi ), alpha ) );
+    }
+    scalar_pixel_kernels().depth_to_gray( src + i / 2, dst + i * 4, dst_pixels - i, clamp_min, true );
+  }
+  else
+  {
+    for ( ; i + 8 <= dst_pixels; i += 8, d += 2 )
+    {
+      __m128i q8   = quantize_depth8( _mm_loadu_si128( (const __m128i *)(src + i) ), minv );
+      __m128i q16  = _mm_unpacklo_epi8( q8, q8 );
+      _mm_storeu_si128( d,     _mm_or_si128( _mm_unpacklo_epi16( q16, q16 ), alpha ) );
+      _mm_storeu_si128( d + 1, _mm_or_si128( _mm_unpackhi_epi16( q16, q16 ), alpha ) );
+    }
+    scalar_pixel_kernels().depth_to_gray( src + i, dst + i * 4, dst_pixels - i, clamp_min, false );
+  }
+}
+
+static void depth_pack_sse41( const uint16_t *src, uint8_t *dst, size_t dst_pixels, bool upsample2x )
+{
+  // byte swaps 16-bit depth values into red and green of RGBA pixels
+  const __m128i pack_lo = _mm_setr_epi8( 1, 0, -1, -1, 3, 2, -1, -1, 5, 4, -1, -1, 7, 6, -1, -1 );
+  const __m128i pack_hi = _mm_setr_epi8( 9, 8, -1, -1, 11, 10, -1, -1, 13, 12, -1, -1, 15, 14, -1, -1 );
+  const __m128i twice_0 = _mm_setr_epi8( 1, 0, -1, -1, 1, 0, -1, -1, 3, 2, -1, -1, 3, 2, -1, -1 );
+  const __m128i twice_1 = _mm_setr_epi8( 5, 4, -1, -1, 5, 4, -1, -1, 7, 6, -1, -1, 7, 6, -1, -1 );
+  const __m128i twice_2 = _mm_setr_epi8( 9, 8, -1, -1, 9, 8, -1, -1, 11, 10, -1, -1, 11, 10, -1, -1 );
+  const __m128i twice_3 = _mm_setr_epi8( 13, 12, -1, -1, 13, 12, -1, -1, 15, 14, -1, -1, 15, 14, -1, -1 );
+  const __m128i alpha = _mm_set1_epi32( (int)0xFF000000 );
+  size_t i = 0;
+  __m128i *d = (__m128i *)dst;
+  if ( upsample2x )
+  {
+    for ( ; i + 16 <= dst_pixels; i += 16, d += 4 )
+    {
+      __m128i depth = _mm_loadu_si128( (const __m128i *)(src + i / 2) );
+      _mm_storeu_si128( d,     _mm_or_si128( _mm_shuffle_epi8( depth, twice_0 ), alpha ) );
+      _mm_storeu_si128( d + 1, _mm_or_si128( _mm_shuffle_epi8( depth, twice_1 ), alpha ) );
+      _mm_storeu_si128( d + 2, _mm_or_si128( _mm_shuffle_epi8( depth, twice_2 ), alpha ) );
+      _mm_storeu_si128( d + 3, _mm_or_si128( _mm_shuffle_epi8( depth, twice_3 ), alpha ) );
+    }
+    scalar_pixel_kernels().depth_pack( src + i / 2, dst + i * 4, dst_pixels - i, true );
+  }
+  else
+  {
+    for ( ; i + 8 <= dst_pixels; i += 8, d += 2 )
+    {
+      __m128i depth = _mm_loadu_si128( (const __m128i *)(src + i) );
+      _mm_storeu_si128( d,     _mm_or_si128( _mm_shuffle_epi8( depth, pack_lo ), alpha ) );
+      _mm_storeu_si128( d + 1, _mm_or_si128( _mm_shuffle_epi8( depth, pack_hi ), alpha ) );
+    }
+    scalar_pixel_kernels().depth_pack( src + i, dst + i * 4, dst_pixels - i, false );
+  }
+}
+
+extern const pixel_kernels sse41_pixel_kernels = { "SSE4.1", rgb_to_rgba_sse41, yuyv_to_rgba_sse41,
+                                                    depth_to_gray_sse41, depth_lookup_scalar, depth_pack_sse41 };
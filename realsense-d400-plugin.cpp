@@ -18,6 +18,7 @@
 */
 
 #include <obs-module.h>
+#include "device_manager.h"
 
 /* Defines common functions (required) */
 OBS_DECLARE_MODULE()
@@ -26,12 +27,25 @@ OBS_DECLARE_MODULE()
 OBS_MODULE_USE_DEFAULT_LOCALE("realsense-d400-plugin", "en-US")
 
 extern struct obs_source_info  realsense_d400_s;  /* Defined in my-source.c  */
+extern struct obs_source_info  realsense_d400_async_s;
 
 
 bool obs_module_load(void)
 {
         obs_register_source(&realsense_d400_s);
+        obs_register_source(&realsense_d400_async_s);
+        // camera list is ready by the time anyone opens properties
+        device_manager::instance().watch_cameras();
+        // camera statistics go to OBS log
+        device_manager::instance().set_report_function( []( const std::string & text ) {
+                blog( LOG_INFO, "%s", text.c_str() );
+        });
         
         return true;
 }
 
+void obs_module_unload(void)
+{
+        device_manager::instance().shutdown();
+}
+
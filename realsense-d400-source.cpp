@@ -22,9 +22,15 @@
 #include <librealsense2/rs_advanced_mode.hpp>
 #include <librealsense2/rsutil.h>
 #include "realsense-device.h"
-#include "obs_frame_processor.h"
+#include "obs_frame_worker.h"
+#include "device_manager.h"
+#include "pixel_kernels.h"
+#include "depth_filters.h"
+#include "frame_recorder.h"
 #include <string>
 #include <sstream>
+#include <cstdio>
+#include <ctime>
 #include <list>
 #include <iostream>
 #include <atomic>
@@ -33,28 +39,65 @@
 
 using namespace std;
 const char * DEVICE_LIST_NAME = "devices";
+const char * COLOR_MODE_NAME = "color_mode";
+const char * DEPTH_MODE_NAME = "depth_mode";
+const char * COLOR_FORMAT_NAME = "color_format";
+const char * STATISTICS_NAME = "statistics";
 
 struct realsense_d400_source
 {
   obs_source_t *source;
   realsense_device *rs2dev = { nullptr };
   rs2::config c;
-  list<pair<string,string>> devices;
-  rs2::context ctx;
-  obs_frame_processor frame_processor;
+  obs_frame_worker frame_worker;
   gs_texture_t *texture;
+  // frames are pushed with obs_source_output_video instead of texture uploads
+  bool async_output;
+  // textures and effect for compositing raw depth on GPU
+  gs_texture_t *color_texture;
+  gs_texture_t *depth_texture;
+  gs_effect_t *depth_effect;
+  // depth_lut of raw depth mapping, uploaded as 256x256 texture when it changes
+  depth_lut gpu_lut;
+  gs_texture_t *lut_texture;
+  // whether latest uploaded frame is in color/depth textures instead of texture
+  bool showing_raw_depth;
+  // stream configuration from settings, may differ from device if it was not supported
+  stream_settings requested_streams;
+  // between show and hide callbacks, device is idle otherwise
+  bool shown;
+  // records raw frames of device while "record" is checked, or nullptr
+  frame_recorder *recorder;
+  // shared memory region filtered depth is published into, empty if none
+  string depth_export_name;
 
   realsense_d400_source()
   {
     source = nullptr;
     texture = nullptr;
+    async_output = false;
+    color_texture = nullptr;
+    depth_texture = nullptr;
+    depth_effect = nullptr;
+    lut_texture = nullptr;
+    showing_raw_depth = false;
+    shown = false;
+    recorder = nullptr;
   }
   virtual ~realsense_d400_source()
   {
+    // outside graphics context, see start_output
+    frame_worker.stop();
+    if ( rs2dev ) rs2dev->set_recorder(nullptr);
+    delete recorder;
     obs_enter_graphics();
     gs_texture_destroy(texture);
+    gs_texture_destroy(color_texture);
+    gs_texture_destroy(depth_texture);
+    gs_texture_destroy(lut_texture);
+    gs_effect_destroy(depth_effect);
     obs_leave_graphics();
-    delete rs2dev;
+    device_manager::instance().release(rs2dev);
   }
 };
 
@@ -64,21 +107,202 @@ static const char *realsense_d400_source_get_name(void *unused)
   return obs_module_text("Realsense D400 Input");
 }
 
-static list<pair<string,string>> get_camera_names_serials(realsense_d400_source & s)
+static const char *realsense_d400_async_source_get_name(void *unused)
 {
-  list<pair<string,string>> serials;
-  //Add desired streams to configuration
-  for( auto && dev : s.ctx.query_devices())
+  UNUSED_PARAMETER(unused);
+  return obs_module_text("Realsense D400 Input (async)");
+}
+
+// stream modes are stored in settings as strings like "848x480@30"
+static string stream_mode_to_string( const stream_mode & mode )
+{
+  stringstream ss;
+  ss << mode.width << "x" << mode.height << "@" << mode.fps;
+  return ss.str();
+}
+
+static stream_mode parse_stream_mode( const char * str, rs2_format format )
+{
+  stream_mode mode = { DEFAULT_STREAM_WIDTH, DEFAULT_STREAM_HEIGHT, DEFAULT_STREAM_FPS, format };
+  int width, height, fps;
+  if ( sscanf(str, "%dx%d@%d", &width, &height, &fps) == 3 && width > 0 && height > 0 && fps > 0 )
+  {
+    mode.width = width;
+    mode.height = height;
+    mode.fps = fps;
+  }
+  return mode;
+}
+
+static stream_settings read_stream_settings( obs_data_t *settings )
+{
+  stream_settings streams;
+  rs2_format color_format = (rs2_format)obs_data_get_int(settings, COLOR_FORMAT_NAME);
+  if ( color_format != RS2_FORMAT_RGBA8 && color_format != RS2_FORMAT_YUYV ) color_format = RS2_FORMAT_RGB8;
+  streams.color = parse_stream_mode(obs_data_get_string(settings, COLOR_MODE_NAME), color_format);
+  streams.depth = parse_stream_mode(obs_data_get_string(settings, DEPTH_MODE_NAME), RS2_FORMAT_Z16);
+  return streams;
+}
+
+// Fills color and depth mode lists with modes selected camera supports.
+static void fill_stream_mode_lists( obs_properties_t *props, obs_data_t *settings )
+{
+  stream_settings current = read_stream_settings(settings);
+  camera_info camera;
+  bool found = device_manager::instance().find_camera(obs_data_get_string(settings, DEVICE_LIST_NAME), camera);
+
+  struct { const char *name; rs2_stream stream; stream_mode mode; } lists[] = {
+    { COLOR_MODE_NAME, RS2_STREAM_COLOR, current.color },
+    { DEPTH_MODE_NAME, RS2_STREAM_DEPTH, current.depth }
+  };
+  for ( auto && l : lists )
   {
-    if ( dev.get_info(RS2_CAMERA_INFO_NAME) != std::string("Platform Camera") )
+    obs_property_t *list = obs_properties_get(props, l.name);
+    obs_property_list_clear(list);
+    vector<stream_mode> modes;
+    if ( found ) modes = camera.modes(l.stream, l.mode.format);
+    // without camera, at least keep current selection visible
+    if ( modes.empty() ) modes.push_back(l.mode);
+    for ( auto && mode : modes )
     {
-      string serialnum = dev.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER);
-      string name = dev.get_info(RS2_CAMERA_INFO_NAME);
-      serials.push_back(make_pair(name,serialnum));
+      string str = stream_mode_to_string(mode);
+      obs_property_list_add_string(list, str.c_str(), str.c_str());
     }
   }
+}
 
-  return serials;
+static bool stream_mode_lists_modified( void *data, obs_properties_t *props,
+                                        obs_property_t *property, obs_data_t *settings )
+{
+  UNUSED_PARAMETER(data);
+  UNUSED_PARAMETER(property);
+  fill_stream_mode_lists(props, settings);
+  return true;
+}
+
+// Detaches recorder from device, and finishes recording file.
+static void stop_recording( realsense_d400_source & s )
+{
+  if ( s.recorder == nullptr ) return;
+  if ( s.rs2dev ) s.rs2dev->set_recorder(nullptr);
+  s.recorder->stop();
+  delete s.recorder;
+  s.recorder = nullptr;
+}
+
+// Starts recording into a new file in record_directory when "record" is
+// checked, and stops it when unchecked. Files are named after camera
+// serial number and local time recording started.
+static void update_recording( realsense_d400_source & s, obs_data_t *settings )
+{
+  bool record = obs_data_get_bool(settings, "record") && s.rs2dev != nullptr;
+  if ( !record ) { stop_recording(s); return; }
+  if ( s.recorder != nullptr ) return;
+
+  string directory = obs_data_get_string(settings, "record_directory");
+  if ( directory.empty() )
+  {
+    cerr << "Realsense " << s.rs2dev->serial_number << " has no recording directory set\n";
+    return;
+  }
+  char started[32];
+  time_t now = time(nullptr);
+  strftime(started, sizeof(started), "%Y%m%d-%H%M%S", localtime(&now));
+  string path = directory + "/" + s.rs2dev->serial_number + "-" + started + ".rsdepth";
+  frame_recorder * recorder = new frame_recorder( device_manager::instance().pool() );
+  try {
+    recorder->start( path );
+  }
+  catch ( std::exception & ex )
+  {
+    std::cerr << "Realsense exception " << ex.what() << "\n";
+    delete recorder;
+    return;
+  }
+  s.recorder = recorder;
+  s.rs2dev->set_recorder( recorder );
+}
+
+// Stops processing, recording and capture, and deletes device.
+static void stop_device( realsense_d400_source & s )
+{
+  s.frame_worker.stop();
+  stop_recording( s );
+  if ( s.rs2dev == nullptr ) return;
+  cerr << "Realsense " << s.rs2dev->serial_number << " copied on average "
+       << s.frame_worker.average_bytes_copied() << " bytes per frame\n";
+  device_manager::instance().release(s.rs2dev);
+  s.rs2dev = nullptr;
+}
+
+static string filter_setting( const depth_filter_desc & filter, const filter_option_desc * option = nullptr )
+{
+  string name = string("filter_") + filter.setting;
+  if ( option ) name += string("_") + option->setting;
+  return name;
+}
+
+static depth_filter_settings read_filter_settings( obs_data_t *settings )
+{
+  depth_filter_settings filters;
+  filters.set_order( obs_data_get_string(settings, "filter_order") );
+  filters.disparity_domain = obs_data_get_bool(settings, "filter_disparity");
+  for ( size_t f = 0; f < DEPTH_FILTER_COUNT; f++ )
+  {
+    const depth_filter_desc & filter = depth_filters[f];
+    filters.enabled[f] = obs_data_get_bool(settings, filter_setting(filter).c_str());
+    for ( size_t o = 0; o < filter.option_count; o++ )
+    {
+      filters.values[f][o] = (float)obs_data_get_double(settings, filter_setting(filter, &filter.options[o]).c_str());
+    }
+  }
+  return filters;
+}
+
+static alpha_matte_settings read_matte_settings( obs_data_t *settings )
+{
+  alpha_matte_settings matte;
+  matte.near_depth = (uint16_t)obs_data_get_int(settings, "matte_near_mm");
+  matte.far_depth  = (uint16_t)obs_data_get_int(settings, "matte_far_mm");
+  matte.feather    = (uint16_t)obs_data_get_int(settings, "matte_feather_mm");
+  matte.hysteresis = (uint16_t)obs_data_get_int(settings, "matte_hysteresis_mm");
+  return matte;
+}
+
+// (Re)starts frame worker for color of width x height shown in layout, and
+// sizes texture to match. Worker is stopped before entering graphics
+// context, since finishing a frame may take a while and must not hold up
+// rendering. Tick acquires and uploads frames within graphics context, so
+// buffers are resized and texture recreated within it, where tick can't
+// see them half done.
+static void start_output( realsense_d400_source & s, size_t width, size_t height, int layout )
+{
+  s.frame_worker.stop();
+
+  obs_enter_graphics();
+  s.frame_worker.init( width, height, s.rs2dev, layout );
+  uint32_t video_width  = (uint32_t)s.frame_worker.frame_processor.video_width;
+  uint32_t video_height = (uint32_t)s.frame_worker.frame_processor.video_height;
+  if ( !s.async_output &&
+       (s.texture == nullptr ||
+        gs_texture_get_width(s.texture) != video_width ||
+        gs_texture_get_height(s.texture) != video_height) )
+  {
+    gs_texture_destroy(s.texture);
+    s.texture = gs_texture_create( video_width, video_height, GS_RGBA, 1,
+      nullptr, GS_DYNAMIC);
+  }
+  if ( !s.async_output && s.depth_effect == nullptr )
+  {
+    char *effect_file = obs_module_file("realsense_depth.effect");
+    s.depth_effect = gs_effect_create_from_file(effect_file, nullptr);
+    bfree(effect_file);
+    if ( s.depth_effect == nullptr ) cerr << "could not load realsense_depth.effect\n";
+  }
+  obs_leave_graphics();
+
+  if ( s.async_output ) s.frame_worker.set_async_output( s.source );
+  s.frame_worker.start( device_manager::instance().pool() );
 }
 
 static void realsense_d400_source_update(void *data, obs_data_t *settings)
@@ -88,13 +312,13 @@ static void realsense_d400_source_update(void *data, obs_data_t *settings)
   const bool unload = obs_data_get_bool(settings, "unload");
   
   const char * serial = obs_data_get_string( settings, DEVICE_LIST_NAME );
-  // if selected camera has changed, stop and delete previous one
+  stream_settings streams = read_stream_settings(settings);
+  // if selected camera or its stream configuration has changed, stop and delete previous one
   if (context->rs2dev != nullptr &&
-      (context->rs2dev->serial_number != std::string(serial)) )
+      (context->rs2dev->serial_number != std::string(serial) ||
+       context->requested_streams != streams) )
   {
-    context->rs2dev->stop();
-    delete context->rs2dev;
-    context->rs2dev = nullptr;
+    stop_device( *context );
   }
 
   // read values from settings
@@ -106,49 +330,87 @@ static void realsense_d400_source_update(void *data, obs_data_t *settings)
   if ( depthUnits == 0 )    depthUnits    = DEFAULT_DEPTH_UNITS;
   if ( depthClampMin == 0 ) depthClampMin = DEFAULT_DEPTH_CLAMP_MIN;
   if ( depthClampMax == 0 ) depthClampMax = DEFAULT_DEPTH_CLAMP_MAX;
+
+  // async output has no render step to run the effect in
+  context->frame_worker.frame_processor.raw_depth = !context->async_output &&
+                                                    obs_data_get_bool(settings, "gpu_depth");
+  context->frame_worker.frame_processor.depth_alignment = (int)obs_data_get_int(settings, "depth_alignment");
+  context->frame_worker.frame_processor.compositing_workers = (size_t)obs_data_get_int(settings, "compositing_threads");
+  context->frame_worker.frame_processor.depth_mapping = (int)obs_data_get_int(settings, "depth_mapping");
+  context->frame_worker.frame_processor.set_filters( read_filter_settings(settings) );
+  context->frame_worker.frame_processor.set_matte( read_matte_settings(settings) );
+#if defined(DEPTH_EXPORT)
+  context->depth_export_name = obs_data_get_bool(settings, "export_depth") && *serial ?
+                               string(DEPTH_EXPORT_NAME_PREFIX) + serial : string();
+  context->frame_worker.frame_processor.set_depth_export( context->depth_export_name );
+#endif
+  int layout = (int)obs_data_get_int(settings, "output_layout");
+  if ( layout < 0 || layout >= LAYOUT_COUNT ) layout = LAYOUT_SIDE_BY_SIDE;
   
   if ( std::string(serial) == "" ) return;
   
+  int queue_policy = (int)obs_data_get_int(settings, "queue_policy");
+  int sync_mode = (int)obs_data_get_int(settings, "inter_cam_sync");
+  int idle_policy = (int)obs_data_get_int(settings, "idle_policy");
+  int64_t idle_grace_ns = obs_data_get_int(settings, "idle_grace_seconds") * 1000000000LL;
   if ( context->rs2dev != nullptr )
   {
-    //cerr << "setting depth table values\n";
+    context->rs2dev->queue_policy = queue_policy;
+    context->rs2dev->sync_mode = sync_mode;
+    context->rs2dev->idle_policy = idle_policy;
+    context->rs2dev->idle_grace_ns = idle_grace_ns;
     context->rs2dev->depthClampMin = depthClampMin;
     context->rs2dev->depthClampMax = depthClampMax;
     context->rs2dev->depthUnits = depthUnits;
-    context->rs2dev->set_limits();
+    // written to camera on command thread, dragging a slider must not block
+    device_manager::instance().configure(context->rs2dev);
+    // camera keeps streaming, only output is resized
+    obs_frame_processor & processor = context->frame_worker.frame_processor;
+    if ( layout != processor.layout )
+      start_output( *context, processor.color_width, processor.color_height, layout );
+    update_recording( *context, settings );
     return;
   }
+  context->requested_streams = streams;
   try {
-    context->rs2dev = new realsense_device(serial);
+    camera_info camera;
+    if ( device_manager::instance().find_camera(serial, camera) &&
+         !(camera.supports(RS2_STREAM_COLOR, streams.color) && camera.supports(RS2_STREAM_DEPTH, streams.depth)) )
+    {
+      cerr << "Camera " << serial << " does not support color " << stream_mode_to_string(streams.color)
+           << " with depth " << stream_mode_to_string(streams.depth) << ", using defaults\n";
+      streams = stream_settings();
+    }
+    context->rs2dev = device_manager::instance().create(serial, streams);
 
     // configure limits for depth clamp min and max
     context->rs2dev->depthClampMin = depthClampMin;
     context->rs2dev->depthClampMax = depthClampMax;
     context->rs2dev->depthUnits = depthUnits;
-    context->rs2dev->start();
-  
-    obs_enter_graphics();
-    
-    if ( context->texture == nullptr )
-    {
-      context->frame_processor.init ( 848*2, 480, context->rs2dev);
-      context->texture = gs_texture_create( 848*2, 480, GS_RGBA, 1,
-        nullptr, GS_DYNAMIC);
-    }
-    obs_leave_graphics();
-
+    context->rs2dev->queue_policy = queue_policy;
+    context->rs2dev->sync_mode = sync_mode;
+    context->rs2dev->idle_policy = idle_policy;
+    context->rs2dev->idle_grace_ns = idle_grace_ns;
+    device_manager::instance().start(context->rs2dev);
+    device_manager::instance().set_idle( context->rs2dev, !context->shown );
+    start_output( *context, streams.color.width, streams.color.height, layout );
+    update_recording( *context, settings );
 
   }
   catch ( rs2::error & e )
   {
     std::cerr << "RealSense error calling " << e.get_failed_function() << "(" << e.get_failed_args() << "):\n    " << e.what() << std::endl;
     // make sure we don't have a device 
-    delete context->rs2dev;
+    context->frame_worker.stop();
+    device_manager::instance().release(context->rs2dev);
     context->rs2dev = nullptr;
   }
   catch ( std::exception & ex )
   {
     std::cerr << "Realsense exception " << ex.what() << "\n";
+    context->frame_worker.stop();
+    device_manager::instance().release(context->rs2dev);
+    context->rs2dev = nullptr;
   }
  
 
@@ -164,75 +426,251 @@ static void *realsense_d400_source_create(obs_data_t *settings,
   return context;
 }
 
+static void *realsense_d400_async_source_create(obs_data_t *settings,
+                                                obs_source_t *source)
+{
+  
+  struct realsense_d400_source *context = new realsense_d400_source();
+  context->source = source;
+  context->async_output = true;
+  realsense_d400_source_update(context, settings);
+  return context;
+}
+
 static void realsense_d400_source_destroy(void *data)
 {
   struct realsense_d400_source *context = reinterpret_cast<realsense_d400_source*>(data);
   
-  context->rs2dev->stop();
+  stop_device( *context );
   delete context;
 }
 
 static void realsense_d400_source_defaults(obs_data_t *settings)
 {
   obs_data_set_default_bool(settings, "unload", false);
+  obs_data_set_default_bool(settings, "gpu_depth", false);
+  obs_data_set_default_int(settings, "depth_alignment", DEPTH_ALIGN_NONE);
+  obs_data_set_default_int(settings, "depth_mapping", DEPTH_MAP_STEPS);
+  obs_data_set_default_int(settings, "queue_policy", FRAME_QUEUE_LATEST);
+  obs_data_set_default_int(settings, "inter_cam_sync", INTER_CAM_SYNC_OFF);
+  obs_data_set_default_int(settings, "compositing_threads", 0);
+  obs_data_set_default_int(settings, "idle_policy", IDLE_SKIP_PROCESSING);
+  obs_data_set_default_string(settings, "filter_order", default_filter_order().c_str());
+  obs_data_set_default_bool(settings, "filter_disparity", true);
+  for ( auto & filter : depth_filters )
+  {
+    obs_data_set_default_bool(settings, filter_setting(filter).c_str(), filter.default_enabled);
+    for ( size_t o = 0; o < filter.option_count; o++ )
+    {
+      obs_data_set_default_double(settings, filter_setting(filter, &filter.options[o]).c_str(),
+                                  filter.options[o].default_value);
+    }
+  }
+  obs_data_set_default_int(settings, "idle_grace_seconds", DEFAULT_IDLE_GRACE_SECONDS);
+  obs_data_set_default_int(settings, "output_layout", LAYOUT_SIDE_BY_SIDE);
+  obs_data_set_default_bool(settings, "record", false);
+  obs_data_set_default_string(settings, "record_directory", "");
+  obs_data_set_default_bool(settings, "export_depth", false);
+  alpha_matte_settings matte;
+  obs_data_set_default_int(settings, "matte_near_mm", matte.near_depth);
+  obs_data_set_default_int(settings, "matte_far_mm", matte.far_depth);
+  obs_data_set_default_int(settings, "matte_feather_mm", matte.feather);
+  obs_data_set_default_int(settings, "matte_hysteresis_mm", matte.hysteresis);
+  stream_settings streams;
+  obs_data_set_default_string(settings, COLOR_MODE_NAME, stream_mode_to_string(streams.color).c_str());
+  obs_data_set_default_string(settings, DEPTH_MODE_NAME, stream_mode_to_string(streams.depth).c_str());
+  obs_data_set_default_int(settings, COLOR_FORMAT_NAME, streams.color.format);
 }
 
 static void realsense_d400_source_show(void *data)
 {
   struct realsense_d400_source *context = reinterpret_cast<realsense_d400_source*>(data);
+  context->shown = true;
+  device_manager::instance().set_idle( context->rs2dev, false );
 }
 
 static void realsense_d400_source_hide(void *data)
 {
   struct realsense_d400_source *context = reinterpret_cast<realsense_d400_source*>(data);
+  context->shown = false;
+  device_manager::instance().set_idle( context->rs2dev, true );
 }
 
 static uint32_t realsense_d400_source_getwidth(void *data)
 {
   struct realsense_d400_source *context = reinterpret_cast<realsense_d400_source*>(data);
-  return 848*2;//context->if2.image.cx;
+  size_t width = context->frame_worker.frame_processor.video_width;
+  return width ? (uint32_t)width : DEFAULT_STREAM_WIDTH*2;
 }
 
 static uint32_t realsense_d400_source_getheight(void *data)
 {
   struct realsense_d400_source *context = reinterpret_cast<realsense_d400_source*>(data);
-  return 480;//context->if2.image.cy;
+  size_t height = context->frame_worker.frame_processor.video_height;
+  return height ? (uint32_t)height : DEFAULT_STREAM_HEIGHT;
+}
+
+// Uploads color and 16-bit depth into textures of their own, (re)creating
+// them when frame size changes. Must be called within graphics context.
+// Returns number of bytes uploaded.
+static size_t upload_raw_depth( realsense_d400_source & s, const obs_frame_output & frame )
+{
+  uint32_t color_width  = (uint32_t)s.frame_worker.frame_processor.color_width;
+  uint32_t color_height = (uint32_t)s.frame_worker.frame_processor.color_height;
+  if ( s.color_texture == nullptr ||
+       gs_texture_get_width(s.color_texture) != color_width ||
+       gs_texture_get_height(s.color_texture) != color_height )
+  {
+    gs_texture_destroy(s.color_texture);
+    s.color_texture = gs_texture_create( color_width, color_height, GS_RGBA, 1, nullptr, GS_DYNAMIC);
+  }
+  if ( s.depth_texture == nullptr ||
+       gs_texture_get_width(s.depth_texture) != frame.depth_width ||
+       gs_texture_get_height(s.depth_texture) != frame.depth_height )
+  {
+    gs_texture_destroy(s.depth_texture);
+    s.depth_texture = gs_texture_create( (uint32_t)frame.depth_width, (uint32_t)frame.depth_height,
+                                         GS_R16, 1, nullptr, GS_DYNAMIC);
+  }
+  // color comes either straight from camera frame or from expanded RGB
+  const uint8_t *color = frame.rgba.data();
+  uint32_t color_linesize = color_width * 4;
+  if ( frame.color_frame )
+  {
+    rs2::video_frame color_frame = frame.color_frame;
+    color = reinterpret_cast<const uint8_t *>(color_frame.get_data());
+    color_linesize = (uint32_t)color_frame.get_stride_in_bytes();
+  }
+  // depth comes either straight from filtered frame or from aligner
+  const uint8_t *depth = reinterpret_cast<const uint8_t *>(frame.aligned_depth.data());
+  uint32_t depth_linesize = (uint32_t)(frame.depth_width * sizeof(uint16_t));
+  if ( frame.depth_frame )
+  {
+    rs2::video_frame depth_frame = frame.depth_frame;
+    depth = reinterpret_cast<const uint8_t *>(depth_frame.get_data());
+    depth_linesize = (uint32_t)depth_frame.get_stride_in_bytes();
+  }
+  gs_texture_set_image( s.color_texture, color, color_linesize, false);
+  gs_texture_set_image( s.depth_texture, depth, depth_linesize, false);
+  return color_linesize * color_height + depth_linesize * frame.depth_height;
+}
+
+// Composites color and depth textures with depth effect. Must be called within graphics context.
+static void render_raw_depth( realsense_d400_source & s )
+{
+  obs_frame_processor & processor = s.frame_worker.frame_processor;
+  gs_effect_t *effect = s.depth_effect;
+  uint16_t clamp_min = s.rs2dev ? s.rs2dev->depthClampMin : DEFAULT_DEPTH_CLAMP_MIN;
+  uint16_t clamp_max = s.rs2dev ? s.rs2dev->depthClampMax : DEFAULT_DEPTH_CLAMP_MAX;
+  const int mapping = processor.depth_mapping;
+  const char *technique = "Draw";
+  if ( mapping != DEPTH_MAP_STEPS )
+  {
+    if ( s.lut_texture == nullptr )
+      s.lut_texture = gs_texture_create( 256, 256, GS_RGBA, 1, nullptr, GS_DYNAMIC);
+    if ( s.gpu_lut.update( mapping, clamp_min, clamp_max ) )
+      gs_texture_set_image( s.lut_texture, reinterpret_cast<const uint8_t *>(s.gpu_lut.table()), 256 * 4, false);
+    gs_effect_set_texture(gs_effect_get_param_by_name(effect, "depth_lut"), s.lut_texture);
+    technique = "DrawLut";
+  }
+  struct vec2 size;
+  vec2_set(&size, (float)processor.video_width, (float)processor.video_height);
+
+  gs_effect_set_texture(gs_effect_get_param_by_name(effect, "color_image"), s.color_texture);
+  gs_effect_set_texture(gs_effect_get_param_by_name(effect, "depth_image"), s.depth_texture);
+  gs_effect_set_vec2(gs_effect_get_param_by_name(effect, "output_size"), &size);
+  gs_effect_set_float(gs_effect_get_param_by_name(effect, "clamp_min"), (float)clamp_min);
+  gs_effect_set_float(gs_effect_get_param_by_name(effect, "gray_step"), (float)DEPTH_GRAY_STEP);
+  struct vec2 depth_size;
+  vec2_set(&depth_size, (float)gs_texture_get_width(s.depth_texture), (float)gs_texture_get_height(s.depth_texture));
+  gs_effect_set_vec2(gs_effect_get_param_by_name(effect, "depth_size"), &depth_size);
+  while ( gs_effect_loop(effect, technique) )
+  {
+    gs_draw_sprite(nullptr, 0, (uint32_t)processor.video_width, (uint32_t)processor.video_height );
+  }
 }
 
 static void realsense_d400_source_tick(void *data, float seconds)
 {
   struct realsense_d400_source *context = reinterpret_cast<realsense_d400_source*>(data);
-  rs2::frameset frames;
   if ( context->rs2dev == nullptr ) return;
   
-  if ( context->rs2dev->get_frame( frames))
+  // filtering and compositing happen in frame worker, just pick up the newest result
+  obs_enter_graphics();
+  const obs_frame_output *frame = context->frame_worker.acquire_latest();
+  if ( frame == nullptr )
   {
-    if ( context->frame_processor.update_context( frames,
-                                                  &context->rs2dev->align_to ))
-    {
+    obs_leave_graphics();
+    return;
+  }
 
-      const uint8_t *tmp = context->frame_processor.tmp_data.data();
+  int64_t upload_start = stats_now_ns();
+  if ( frame->raw_depth && context->depth_effect != nullptr )
+  {
+    context->frame_worker.count_copied( upload_raw_depth( *context, *frame ) );
+  }
+  else
+  {
+    uint32_t linesize = (uint32_t)context->frame_worker.frame_processor.video_width*4;
+    gs_texture_set_image( context->texture, frame->rgba.data(), linesize, false);
+    context->frame_worker.count_copied( linesize * context->frame_worker.frame_processor.video_height );
+  }
+  context->showing_raw_depth = frame->raw_depth && context->depth_effect != nullptr;
+  obs_leave_graphics();
+  context->rs2dev->stats.frame_shown( frame->received_ns, frame->published_ns, upload_start, stats_now_ns() );
+}
 
-      obs_enter_graphics();
-      gs_texture_set_image( context->texture,
-                            context->frame_processor.tmp_data.data(),
-                            848*2*4, false);
+// Copies latest statistics report into settings, where the info text shows it.
+static void show_statistics( realsense_d400_source & s )
+{
+  string text = s.rs2dev ? s.rs2dev->stats.latest_report() : string();
+  if ( text.empty() ) text = obs_module_text("No statistics yet");
+  if ( s.rs2dev ) text += "\n" + device_manager::instance().configuration_status(s.rs2dev);
+  if ( s.recorder ) text += "\n" + s.recorder->status();
+  if ( !s.depth_export_name.empty() ) text += "\n" + string(obs_module_text("Sharing filtered depth as ")) + s.depth_export_name;
+  obs_data_t *settings = obs_source_get_settings( s.source );
+  obs_data_set_string( settings, STATISTICS_NAME, text.c_str() );
+  obs_data_release( settings );
+}
+
+static bool refresh_statistics_clicked( obs_properties_t *props, obs_property_t *property, void *data )
+{
+  show_statistics( *reinterpret_cast<realsense_d400_source*>(data) );
+  return true;
+}
 
-      obs_leave_graphics();
 
+// Toggle and options of each depth filter, labeled with what the filter
+// currently costs per frame.
+static void add_filter_properties( obs_properties_t *props, realsense_d400_source & s )
+{
+  obs_frame_processor & processor = s.frame_worker.frame_processor;
+  obs_properties_add_text( props, "filter_order",
+                           obs_module_text("Depth filter order"), OBS_TEXT_DEFAULT );
+  obs_properties_add_bool( props, "filter_disparity",
+                           obs_module_text("Smooth in disparity domain"));
+  for ( auto & filter : depth_filters )
+  {
+    stringstream label;
+    label << obs_module_text(filter.label);
+    float cost = processor.stage_cost_us(filter.stage);
+    if ( cost > 0.0f ) label << " (" << (int)cost << " us/frame)";
+    obs_properties_add_bool( props, filter_setting(filter).c_str(), label.str().c_str() );
+    for ( size_t o = 0; o < filter.option_count; o++ )
+    {
+      const filter_option_desc & option = filter.options[o];
+      obs_properties_add_float_slider( props, filter_setting(filter, &option).c_str(),
+                                       obs_module_text(option.label), option.min, option.max, option.step );
     }
   }
 }
 
-
 static obs_properties_t *realsense_d400_source_properties(void *data)
 {
   struct realsense_d400_source *context = reinterpret_cast<realsense_d400_source*>(data);
-  // get device list
-  if ( context->devices.empty())
-  {
-    context->devices = get_camera_names_serials(*context);
-  }
+  int64_t start_ns = stats_now_ns();
+  // registry is kept current in background, nothing here waits for USB
+  vector<camera_info> cameras = device_manager::instance().cameras();
   
   obs_properties_t *props = obs_properties_create();
   obs_property_t * device_list = obs_properties_add_list( props,
@@ -241,13 +679,37 @@ static obs_properties_t *realsense_d400_source_properties(void *data)
                                                           OBS_COMBO_TYPE_LIST,
                                                           OBS_COMBO_FORMAT_STRING);
   // add devices to list
-  for ( auto && tmp : context->devices )
+  bool own_listed = context->rs2dev == nullptr;
+  for ( auto && camera : cameras )
   {
     stringstream ss;
-    ss << tmp.first << " " << tmp.second;
-    obs_property_list_add_string( device_list, ss.str().c_str(), tmp.second.c_str());
+    ss << camera.name << " " << camera.serial;
+    obs_property_list_add_string( device_list, ss.str().c_str(), camera.serial.c_str());
+    if ( context->rs2dev && camera.serial == context->rs2dev->serial_number ) own_listed = true;
+  }
+  // unplugged camera stays selected, it is reconnected when plugged back in
+  if ( !own_listed )
+  {
+    string text = context->rs2dev->serial_number + " " + obs_module_text("(not connected)");
+    obs_property_list_add_string( device_list, text.c_str(), context->rs2dev->serial_number.c_str());
   }
 
+  // stream modes offered depend on selected camera and color format
+  obs_property_t * color_format = obs_properties_add_list( props, COLOR_FORMAT_NAME,
+                                                           obs_module_text("Color format"),
+                                                           OBS_COMBO_TYPE_LIST,
+                                                           OBS_COMBO_FORMAT_INT);
+  obs_property_list_add_int( color_format, "RGB8", RS2_FORMAT_RGB8 );
+  obs_property_list_add_int( color_format, "RGBA8", RS2_FORMAT_RGBA8 );
+  // D400 color sensors deliver YUYV, other formats are converted by librealsense
+  obs_property_list_add_int( color_format, "YUYV", RS2_FORMAT_YUYV );
+  obs_properties_add_list( props, COLOR_MODE_NAME, obs_module_text("Color resolution and rate"),
+                           OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_STRING);
+  obs_properties_add_list( props, DEPTH_MODE_NAME, obs_module_text("Depth resolution and rate"),
+                           OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_STRING);
+  obs_property_set_modified_callback2( device_list, stream_mode_lists_modified, context );
+  obs_property_set_modified_callback2( color_format, stream_mode_lists_modified, context );
+
 
 
   // define adjustable values
@@ -261,7 +723,88 @@ static obs_properties_t *realsense_d400_source_properties(void *data)
 	obs_properties_add_int(props, "depth_units",
                          obs_module_text("Depth units in micrometers"), 100, 65000,
                          1);
-
+  if ( !context->async_output )
+  {
+    obs_properties_add_bool(props, "gpu_depth",
+                            obs_module_text("Quantize depth on GPU"));
+  }
+  obs_property_t * mapping = obs_properties_add_list( props, "depth_mapping",
+                                                      obs_module_text("Depth mapping"),
+                                                      OBS_COMBO_TYPE_LIST,
+                                                      OBS_COMBO_FORMAT_INT);
+  for ( int m = 0; m < DEPTH_MAP_COUNT; m++ )
+  {
+    obs_property_list_add_int( mapping, obs_module_text(depth_mapping_name(m)), m );
+  }
+  add_filter_properties( props, *context );
+  obs_property_t * layout = obs_properties_add_list( props, "output_layout",
+                                                     obs_module_text("Output layout"),
+                                                     OBS_COMBO_TYPE_LIST,
+                                                     OBS_COMBO_FORMAT_INT);
+  for ( int l = 0; l < LAYOUT_COUNT; l++ )
+  {
+    obs_property_list_add_int( layout, obs_module_text(output_layout_name(l)), l );
+  }
+  // depth keying, in same units as clamp min and max
+  obs_properties_add_int( props, "matte_near_mm", obs_module_text("Key depth near (mm)"), 1, 65000, 1 );
+  obs_properties_add_int( props, "matte_far_mm", obs_module_text("Key depth far (mm)"), 1, 65000, 1 );
+  obs_properties_add_int( props, "matte_feather_mm", obs_module_text("Key edge feathering (mm)"), 0, 5000, 1 );
+  obs_properties_add_int( props, "matte_hysteresis_mm", obs_module_text("Key hysteresis (mm)"), 0, 5000, 1 );
+  obs_property_t * alignment = obs_properties_add_list( props, "depth_alignment",
+                                                        obs_module_text("Align depth to color"),
+                                                        OBS_COMBO_TYPE_LIST,
+                                                        OBS_COMBO_FORMAT_INT);
+  obs_property_list_add_int( alignment, obs_module_text("Off"), DEPTH_ALIGN_NONE );
+  obs_property_list_add_int( alignment, obs_module_text("librealsense"), DEPTH_ALIGN_LIBREALSENSE );
+  obs_property_list_add_int( alignment, obs_module_text("Cached reprojection"), DEPTH_ALIGN_CACHED );
+  obs_property_t * queue_policy = obs_properties_add_list( props, "queue_policy",
+                                                           obs_module_text("Frames from camera"),
+                                                           OBS_COMBO_TYPE_LIST,
+                                                           OBS_COMBO_FORMAT_INT);
+  obs_property_list_add_int( queue_policy, obs_module_text("Newest only, lowest latency"), FRAME_QUEUE_LATEST );
+  obs_property_list_add_int( queue_policy, obs_module_text("Every frame, queued"), FRAME_QUEUE_FIFO );
+  obs_property_t * sync = obs_properties_add_list( props, "inter_cam_sync",
+                                                   obs_module_text("Hardware sync between cameras"),
+                                                   OBS_COMBO_TYPE_LIST,
+                                                   OBS_COMBO_FORMAT_INT);
+  obs_property_list_add_int( sync, obs_module_text("Off"), INTER_CAM_SYNC_OFF );
+  obs_property_list_add_int( sync, obs_module_text("Master"), INTER_CAM_SYNC_MASTER );
+  obs_property_list_add_int( sync, obs_module_text("Slave"), INTER_CAM_SYNC_SLAVE );
+  obs_property_t * idle = obs_properties_add_list( props, "idle_policy",
+                                                   obs_module_text("When not shown"),
+                                                   OBS_COMBO_TYPE_LIST,
+                                                   OBS_COMBO_FORMAT_INT);
+  obs_property_list_add_int( idle, obs_module_text("Keep streaming, skip processing"), IDLE_SKIP_PROCESSING );
+  obs_property_list_add_int( idle, obs_module_text("Process one frame per second"), IDLE_THROTTLE );
+  obs_property_list_add_int( idle, obs_module_text("Stop camera after grace period"), IDLE_STOP_STREAMING );
+  obs_properties_add_int( props, "idle_grace_seconds",
+                          obs_module_text("Seconds before stopping a camera not shown"), 0, 3600, 1 );
+  // 0 uses every thread of the shared pool
+  obs_properties_add_int( props, "compositing_threads",
+                          obs_module_text("Compositing threads (0 = one per core)"), 0,
+                          parallel_tiles::MAX_WORKERS, 1 );
+
+  // raw color and depth as they arrive from camera, before filters
+  obs_properties_add_bool( props, "record", obs_module_text("Record camera frames") );
+  obs_properties_add_path( props, "record_directory", obs_module_text("Recording directory"),
+                           OBS_PATH_DIRECTORY, nullptr, nullptr );
+#if defined(DEPTH_EXPORT)
+  // for other processes on this machine, see depth_export.h
+  obs_properties_add_bool( props, "export_depth", obs_module_text("Share filtered depth in shared memory") );
+#endif
+
+  // latency and drop statistics, written to log every STATS_REPORT_INTERVAL_SECONDS
+  show_statistics( *context );
+#if LIBOBS_API_VER >= MAKE_SEMANTIC_VERSION(27, 1, 0)
+  obs_properties_add_text( props, STATISTICS_NAME, obs_module_text("Statistics"), OBS_TEXT_INFO );
+#else
+  obs_property_set_enabled( obs_properties_add_text( props, STATISTICS_NAME, obs_module_text("Statistics"),
+                                                     OBS_TEXT_MULTILINE ), false );
+#endif
+  obs_properties_add_button2( props, "refresh_statistics", obs_module_text("Refresh statistics"),
+                              refresh_statistics_clicked, context );
+
+  cerr << "Realsense properties built in " << (stats_now_ns() - start_ns) / 1000 << " us\n";
   return props;
 }
 static void realsense_d400_source_render(void *data, gs_effect_t *effect)
@@ -272,10 +815,21 @@ static void realsense_d400_source_render(void *data, gs_effect_t *effect)
 
   
   obs_enter_graphics();
+  if ( context->showing_raw_depth )
+  {
+    render_raw_depth( *context );
+    obs_leave_graphics();
+    return;
+  }
+  // source does custom drawing, so default effect has to be set up here
+  effect = obs_get_base_effect(OBS_EFFECT_DEFAULT);
   gs_eparam_t *image = gs_effect_get_param_by_name(effect, "image");
   gs_effect_set_texture(image, context->texture);
-  gs_draw_sprite(context->texture, 0, context->frame_processor.video_width,
-                 context->frame_processor.video_height );
+  while ( gs_effect_loop(effect, "Draw") )
+  {
+    gs_draw_sprite(context->texture, 0, context->frame_worker.frame_processor.video_width,
+                   context->frame_worker.frame_processor.video_height );
+  }
   obs_leave_graphics();
   
 
@@ -287,7 +841,7 @@ static void realsense_d400_source_render(void *data, gs_effect_t *effect)
 /*struct obs_source_info realsense_d400_s = {
   .id           = "realsense-d400",
   .type         = OBS_SOURCE_TYPE_INPUT,
-  .output_flags = OBS_SOURCE_VIDEO,
+  .output_flags = OBS_SOURCE_VIDEO | OBS_SOURCE_CUSTOM_DRAW,
   .get_name     = realsense_d400_source_get_name,
   .create       = realsense_d400_source_create,
   .destroy      = realsense_d400_source_destroy,
@@ -306,7 +860,7 @@ static void realsense_d400_source_render(void *data, gs_effect_t *effect)
 struct obs_source_info realsense_d400_s = {
                                            "realsense-d400",
                                            OBS_SOURCE_TYPE_INPUT,
-                                           OBS_SOURCE_VIDEO,
+                                           OBS_SOURCE_VIDEO | OBS_SOURCE_CUSTOM_DRAW,
                                            realsense_d400_source_get_name,
                                            realsense_d400_source_create,
                                            realsense_d400_source_destroy,
@@ -322,3 +876,25 @@ struct obs_source_info realsense_d400_s = {
                                            realsense_d400_source_tick,
                                            realsense_d400_source_render
 };
+
+// Same device handling, but frames are handed to OBS with device timestamps and
+// OBS takes care of upload and frame pacing.
+struct obs_source_info realsense_d400_async_s = {
+                                           "realsense-d400-async",
+                                           OBS_SOURCE_TYPE_INPUT,
+                                           OBS_SOURCE_ASYNC_VIDEO,
+                                           realsense_d400_async_source_get_name,
+                                           realsense_d400_async_source_create,
+                                           realsense_d400_source_destroy,
+                                           nullptr,
+                                           nullptr,
+                                           realsense_d400_source_defaults,
+                                           realsense_d400_source_properties,
+                                           realsense_d400_source_update,
+                                           nullptr,
+                                           nullptr,
+                                           realsense_d400_source_show,
+                                           realsense_d400_source_hide,
+                                           nullptr,
+                                           nullptr
+};
@@ -21,15 +21,140 @@
 
 #include <librealsense2/rs.hpp> 
 #include <librealsense2/rs_advanced_mode.hpp>
+#include <librealsense2/hpp/rs_internal.hpp>
 #include <stdexcept>
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <thread>
 #include <atomic>
+#include <iostream>
+#include "cpu_usage.h"
+#include "frame_stats.h"
+#include "frame_mailbox.h"
+#include "thread_pool.h"
+#include "frame_recorder.h"
+#include <mutex>
 // some reasonable defaults for depth data limits
 const uint16_t DEFAULT_DEPTH_CLAMP_MIN = 10000;
 const uint16_t DEFAULT_DEPTH_CLAMP_MAX = 35500;
 const uint16_t DEFAULT_DEPTH_UNITS = 100; // 100 micrometers, = 0.1mm
 const size_t   DEFAULT_FRAME_QUEUE_CAPACITY = 5;
+// how long wait_frame callers should block before checking for stop requests
+const unsigned int FRAME_WAIT_TIMEOUT_MS = 100;
+const int      DEFAULT_STREAM_WIDTH = 848;
+const int      DEFAULT_STREAM_HEIGHT = 480;
+const int      DEFAULT_STREAM_FPS = 30;
+// frame interval of IDLE_THROTTLE
+const unsigned int IDLE_THROTTLE_INTERVAL_MS = 1000;
+const int      DEFAULT_IDLE_GRACE_SECONDS = 10;
+
+// RS2_OPTION_INTER_CAM_SYNC_MODE values of D400 cameras. Master drives
+// the sync cable, slaves follow it.
+enum inter_cam_sync_mode
+{
+  INTER_CAM_SYNC_OFF = 0,
+  INTER_CAM_SYNC_MASTER = 1,
+  INTER_CAM_SYNC_SLAVE = 2
+};
+
+// How framesets are passed from capture thread to processing.
+enum frame_queue_policy
+{
+  // every frameset in order, up to DEFAULT_FRAME_QUEUE_CAPACITY behind
+  FRAME_QUEUE_FIFO = 0,
+  // only the newest frameset, older unprocessed ones are discarded
+  FRAME_QUEUE_LATEST = 1
+};
+
+// What is done with frames of a camera whose source is not shown anywhere.
+enum idle_policy
+{
+  // keep streaming, but drop framesets without filtering or compositing
+  IDLE_SKIP_PROCESSING = 0,
+  // process one frameset per IDLE_THROTTLE_INTERVAL_MS, so image stays fresh
+  IDLE_THROTTLE = 1,
+  // stop streaming after a grace period, restart when shown again
+  IDLE_STOP_STREAMING = 2
+};
+
+// Resolution, rate and pixel format of a single stream.
+struct stream_mode
+{
+  int width;
+  int height;
+  int fps;
+  rs2_format format;
+
+  bool operator==( const stream_mode & other ) const
+  {
+    return width == other.width && height == other.height &&
+           fps == other.fps && format == other.format;
+  }
+  bool operator!=( const stream_mode & other ) const { return !(*this == other); }
+  // sorts largest and fastest first
+  bool operator<( const stream_mode & other ) const
+  {
+    if ( width != other.width ) return width > other.width;
+    if ( height != other.height ) return height > other.height;
+    return fps > other.fps;
+  }
+};
+
+// Camera options written over USB by realsense_device::set_limits().
+struct device_config
+{
+  uint16_t depthClampMin = DEFAULT_DEPTH_CLAMP_MIN;
+  uint16_t depthClampMax = DEFAULT_DEPTH_CLAMP_MAX;
+  uint16_t depthUnits = DEFAULT_DEPTH_UNITS;
+  int sync_mode = INTER_CAM_SYNC_OFF;
+
+  bool operator==( const device_config & other ) const
+  {
+    return depthClampMin == other.depthClampMin && depthClampMax == other.depthClampMax &&
+           depthUnits == other.depthUnits && sync_mode == other.sync_mode;
+  }
+  bool operator!=( const device_config & other ) const { return !(*this == other); }
+};
+
+struct stream_settings
+{
+  stream_mode color { DEFAULT_STREAM_WIDTH, DEFAULT_STREAM_HEIGHT, DEFAULT_STREAM_FPS, RS2_FORMAT_RGB8 };
+  stream_mode depth { DEFAULT_STREAM_WIDTH, DEFAULT_STREAM_HEIGHT, DEFAULT_STREAM_FPS, RS2_FORMAT_Z16 };
+
+  bool operator==( const stream_settings & other ) const
+  {
+    return color == other.color && depth == other.depth;
+  }
+  bool operator!=( const stream_settings & other ) const { return !(*this == other); }
+};
+
+// Lists modes device offers for given stream and format, largest first.
+inline std::vector<stream_mode> supported_stream_modes( const rs2::device & dev, rs2_stream stream, rs2_format format )
+{
+  std::vector<stream_mode> modes;
+  for ( auto && sensor : dev.query_sensors() )
+  {
+    for ( auto && profile : sensor.get_stream_profiles() )
+    {
+      if ( profile.stream_type() != stream || profile.format() != format ||
+           !profile.is<rs2::video_stream_profile>() ) continue;
+      auto video = profile.as<rs2::video_stream_profile>();
+      stream_mode mode = { video.width(), video.height(), video.fps(), format };
+      if ( std::find(modes.begin(), modes.end(), mode) == modes.end() ) modes.push_back(mode);
+    }
+  }
+  std::sort(modes.begin(), modes.end());
+  return modes;
+}
+
+// Next value for realsense_device::align_generation, never 0 and never
+// repeated within process.
+inline uint64_t next_align_generation()
+{
+  static std::atomic<uint64_t> generation{ 0 };
+  return ++generation;
+}
 
 class realsense_device
 {
@@ -37,21 +162,64 @@ public:
   rs2::pipeline pipe;
   rs2::pipeline_profile profile;
   rs2::align * align {nullptr};
-  rs2_stream align_to;
+  // Identifies align among those of all devices. Its address does not,
+  // a new one may be allocated where a deleted one was.
+  uint64_t align_generation {0};
+  rs2_stream align_to {RS2_STREAM_COLOR};
 
   rs2::config cfg;
   rs2::frame_queue framequeue;
-  std::thread * processing_thread;
-  std::atomic_bool run_processing_thread;
+  frame_mailbox mailbox;
+  // one of frame_queue_policy, may be changed while running
+  std::atomic<int> queue_policy{ FRAME_QUEUE_LATEST };
+  std::atomic_bool started {false};
+  thread_cpu_meter capture_cpu;
+  bool capture_cpu_started {false};
+  // latencies and drops from capture to OBS, recorded by each thread on the way
+  frame_stats stats;
   std::string serial_number;
+  stream_settings streams;
   uint16_t depthClampMin = DEFAULT_DEPTH_CLAMP_MIN;
   uint16_t depthClampMax = DEFAULT_DEPTH_CLAMP_MAX;
   uint16_t depthUnits = DEFAULT_DEPTH_UNITS;
+  // RS2_OPTION_INTER_CAM_SYNC_MODE value, one of inter_cam_sync_mode
+  int sync_mode = INTER_CAM_SYNC_OFF;
+  // device timestamp of newest frameset and its domain, for measuring skew between cameras
+  std::atomic<double> latest_timestamp{ 0.0 };
+  std::atomic<int> latest_timestamp_domain{ RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK };
+  // one of idle_policy, and how long IDLE_STOP_STREAMING waits before stopping
+  std::atomic<int> idle_policy{ IDLE_SKIP_PROCESSING };
+  std::atomic<int64_t> idle_grace_ns{ DEFAULT_IDLE_GRACE_SECONDS * 1000000000LL };
+  // Set with device_manager::set_idle(). idle_since_ns is when source was
+  // hidden, restart_requested_ns when it was shown while stopped for being idle.
+  std::atomic_bool idle{ false };
+  std::atomic<int64_t> idle_since_ns{ 0 };
+  std::atomic<int64_t> restart_requested_ns{ 0 };
+  bool stopped_for_idle {false};
+  // camera was unplugged, device_manager reconnects when it is back
+  bool disconnected {false};
+  // Starting failed, usually because camera was not plugged in yet.
+  // device_manager retries when camera is found.
+  bool start_failed {false};
+  // Configuration requested with device_manager::configure() and the one
+  // last written to camera, versions count requests. Guarded by device_manager.
+  device_config requested_config;
+  device_config applied_config;
+  uint64_t requested_version {0};
+  uint64_t applied_version {0};
+  // why latest start or configuration failed, empty if it did not
+  std::string config_error;
   
-  realsense_device(const std::string & serial) : framequeue(DEFAULT_FRAME_QUEUE_CAPACITY),
-                                                 serial_number(serial) {
-    cfg.enable_stream(RS2_STREAM_COLOR, 848, 480, RS2_FORMAT_RGB8, 30);
-    cfg.enable_stream(RS2_STREAM_DEPTH, 848, 480, RS2_FORMAT_Z16, 30);
+  realsense_device(const std::string & serial,
+                   const stream_settings & settings = stream_settings(),
+                   rs2::context ctx = rs2::context()) : pipe(ctx),
+                                                        framequeue(DEFAULT_FRAME_QUEUE_CAPACITY),
+                                                        serial_number(serial),
+                                                        streams(settings) {
+    cfg.enable_stream(RS2_STREAM_COLOR, streams.color.width, streams.color.height,
+                      streams.color.format, streams.color.fps);
+    cfg.enable_stream(RS2_STREAM_DEPTH, streams.depth.width, streams.depth.height,
+                      streams.depth.format, streams.depth.fps);
     cfg.enable_device(serial);
   }
   virtual ~realsense_device()
@@ -60,33 +228,97 @@ public:
     delete align;
 
   }
+  // Starts streaming. Framesets are delivered on a librealsense thread,
+  // which queues them and schedules the consumer task. Camera options are
+  // not touched, see set_limits().
   void start()
   {
-    profile = pipe.start(cfg);
+    // a restarted pipeline calls back on a new thread
+    capture_cpu_started = false;
+    profile = pipe.start(cfg, [this]( rs2::frame f ) { frames_arrived(f); });
+    started = true;
     align_to = profile.get_stream(RS2_STREAM_COLOR).stream_type();
-    align = new rs2::align(align_to);
-    set_limits();
-    start_processing_thread();
+    // kept over restarts, frame processor has set up its callback
+    if ( align == nullptr )
+    {
+      align = new rs2::align(align_to);
+      align_generation = next_align_generation();
+    }
   }
   void stop()
   {
-    run_processing_thread = false;
-    processing_thread->join();
+    if ( !started ) return;
+    started = false;
+    // returns after last callback has finished
     pipe.stop();
-    
+    std::cerr << "Realsense " << serial_number << " capture callback CPU load was "
+              << capture_cpu_load() * 100.0f << "%\n";
+  }
+  // Task scheduled whenever a frameset is queued, or nullptr.
+  void set_consumer( pool_task * task )
+  {
+    std::lock_guard<std::mutex> lock(consumer_mutex);
+    consumer = task;
+  }
+  // Recorder handed every frameset as it arrives, or nullptr.
+  void set_recorder( frame_recorder * r )
+  {
+    std::lock_guard<std::mutex> lock(consumer_mutex);
+    recorder = r;
+  }
+  // fraction of a single core spent in capture callback, refreshed about once per second.
+  float capture_cpu_load() const
+  {
+    return capture_cpu.load();
   }
        
   // returns true if frame was received, and sets param frameset to current set.
   bool get_frame( rs2::frameset & frameset )
   {
+    // a frameset left in mailbox after switching to FIFO is older than anything queued
+    if ( mailbox.poll(&frameset) ) return true;
     return framequeue.poll_for_frame(&frameset);
   }
+  // like get_frame, but waits at most timeout_ms for a frameset to arrive.
+  bool wait_frame( rs2::frameset & frameset, unsigned int timeout_ms )
+  {
+    if ( queue_policy == FRAME_QUEUE_FIFO )
+    {
+      if ( mailbox.poll(&frameset) ) return true;
+      return framequeue.try_wait_for_frame(&frameset, timeout_ms);
+    }
+    // discard whatever was queued before switching to latest
+    while ( framequeue.poll_for_frame(&frameset) ) {}
+    return mailbox.try_wait(&frameset, timeout_ms);
+  }
 
 
-  void set_limits()
+  // depth table and sync options set on source, as one configuration
+  device_config current_config() const
+  {
+    device_config config;
+    config.depthClampMin = depthClampMin;
+    config.depthClampMax = depthClampMax;
+    config.depthUnits = depthUnits;
+    config.sync_mode = sync_mode;
+    return config;
+  }
+  // Writes configuration to camera. Takes tens to hundreds of milliseconds
+  // over USB, so it runs on device_manager's command thread.
+  void set_limits( const device_config & config )
   {
     auto rs_dev = profile.get_device();
+    // recordings and software devices used for testing have nothing to configure
+    if ( rs_dev.is<rs2::playback>() || rs_dev.is<rs2::software_device>() ) return;
     auto depth_sensor = rs_dev.first<rs2::depth_sensor>();
+    if ( depth_sensor.supports(RS2_OPTION_INTER_CAM_SYNC_MODE) )
+    {
+      depth_sensor.set_option( RS2_OPTION_INTER_CAM_SYNC_MODE, (float)config.sync_mode );
+    }
+    else if ( config.sync_mode != INTER_CAM_SYNC_OFF )
+    {
+      std::cerr << "Realsense " << serial_number << " does not support inter-camera sync\n";
+    }
     // this ought to set the actual depth unit value
     depth_sensor.set_option( RS2_OPTION_DEPTH_UNITS, 0.01);
     if (rs_dev.is<rs400::advanced_mode>())
@@ -100,9 +332,9 @@ public:
       }
       
       STDepthTableControl depth_table_control = adv_mode_dev.get_depth_table();
-      depth_table_control.depthUnits = depthUnits;
-      depth_table_control.depthClampMin = depthClampMin;
-      depth_table_control.depthClampMax = depthClampMax;
+      depth_table_control.depthUnits = config.depthUnits;
+      depth_table_control.depthClampMin = config.depthClampMin;
+      depth_table_control.depthClampMax = config.depthClampMax;
       adv_mode_dev.set_depth_table(depth_table_control);
     }
     else
@@ -111,23 +343,45 @@ public:
     }
   }
 protected: 
-  void start_processing_thread()
-  {
-    processing_thread = new std::thread(process_device, this);
-  }
-  
-  static void process_device( realsense_device * dev )
+  std::mutex consumer_mutex;
+  pool_task * consumer {nullptr};
+  frame_recorder * recorder {nullptr};
+
+  void frames_arrived( rs2::frame f )
   {
-    bool hadFrames = false;
-    while( dev->run_processing_thread  )
+    // CPU time is per thread, so meter can only start on callback thread
+    if ( !capture_cpu_started )
     {
-      rs2::frameset frames;
-      if ( dev->pipe.poll_for_frames(&frames) )
+      capture_cpu.reset();
+      capture_cpu_started = true;
+    }
+    rs2::frameset frames = f;
+    int64_t arrival_ms = 0;
+    if ( frames.supports_frame_metadata(RS2_FRAME_METADATA_TIME_OF_ARRIVAL) )
+    {
+      arrival_ms = (int64_t)frames.get_frame_metadata(RS2_FRAME_METADATA_TIME_OF_ARRIVAL);
+    }
+    int64_t now = stats_now_ns();
+    stats.frame_received(frames.get_frame_number(), arrival_ms, now);
+    if ( restart_requested_ns.load(std::memory_order_relaxed) != 0 )
+    {
+      int64_t requested = restart_requested_ns.exchange(0);
+      if ( requested != 0 )
       {
-        dev->framequeue.enqueue(frames);
+        stats.record_us(frame_stats::LATENCY_RESTART, (now - requested) / 1000.0);
+        std::cerr << "Realsense " << serial_number << " restarted in "
+                  << (now - requested) / 1000000 << " ms\n";
       }
     }
+    latest_timestamp_domain = frames.get_frame_timestamp_domain();
+    latest_timestamp = frames.get_timestamp();
+    if ( queue_policy == FRAME_QUEUE_FIFO ) framequeue.enqueue(frames);
+    else                                    mailbox.post(frames);
+    {
+      std::lock_guard<std::mutex> lock(consumer_mutex);
+      if ( consumer != nullptr ) consumer->schedule();
+      if ( recorder != nullptr ) recorder->record(frames);
+    }
+    capture_cpu.sample();
   }
-
-  
 };
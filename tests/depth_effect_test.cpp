@@ -0,0 +1,146 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+// Emulates in float32 how data/realsense_depth.effect quantizes depth on
+// the GPU, and checks that it gives the same gray level as
+// depth_to_gray_value on the CPU for every depth value and a range of
+// clamp minimums. Sampled R16 values are also nudged by one ulp both ways,
+// since GPUs need not round normalization exactly. If path of the effect
+// is given, also checks that it still contains the emulated formulas, so
+// changing one without the other fails here.
+#include "pixel_kernels.h"
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Lines of PSComposite and PSCompositeLut emulated below.
+static const char * const EMULATED_LINES[] = {
+  "return floor(depth_image.Load(int3(int2(src), 0)).r * 65535.0 + 0.5);",
+  "float diff = depth - clamp_min;",
+  "float level = floor((diff + 0.5) / gray_step);",
+  "if (diff < 0.0 || level > 255.0)",
+  "float gray = level / 255.0;",
+  "float high = floor(depth / 256.0);",
+  "return depth_lut.Load(int3(int(depth - high * 256.0), int(high), 0));"
+};
+
+static size_t failures = 0;
+
+static void fail( const string & what )
+{
+  if ( failures++ < 20 ) printf( "FAILED: %s\n", what.c_str() );
+}
+
+// LoadDepth, from R16 sample back to integer depth
+static float load_depth( float sample )
+{
+  return floorf( sample * 65535.0f + 0.5f );
+}
+
+// PSComposite, gray level as stored into 8-bit render target
+static int shader_gray( float depth, float clamp_min, float gray_step )
+{
+  float diff = depth - clamp_min;
+  float level = floorf( (diff + 0.5f) / gray_step );
+  if ( diff < 0.0f || level > 255.0f )
+    level = 0.0f;
+  float gray = level / 255.0f;
+  return (int)floorf( gray * 255.0f + 0.5f );
+}
+
+static void test_load_depth()
+{
+  for ( uint32_t d = 0; d < 65536; d++ )
+  {
+    float sample = (float)d / 65535.0f;
+    for ( float s : { sample, nextafterf( sample, 0.0f ), nextafterf( sample, 2.0f ) } )
+    {
+      if ( load_depth( s ) != (float)d )
+      {
+        fail( "depth " + to_string(d) + " loads as " + to_string(load_depth( s )) );
+        break;
+      }
+    }
+  }
+}
+
+static void test_gray( uint16_t clamp_min )
+{
+  for ( uint32_t d = 0; d < 65536; d++ )
+  {
+    int expected = depth_to_gray_value( (uint16_t)d, clamp_min );
+    int actual = shader_gray( (float)d, (float)clamp_min, (float)DEPTH_GRAY_STEP );
+    if ( actual != expected )
+    {
+      fail( "depth " + to_string(d) + " clamp min " + to_string(clamp_min) + " is gray " +
+            to_string(actual) + " on GPU, " + to_string(expected) + " on CPU" );
+      return;
+    }
+  }
+}
+
+// PSCompositeLut, low and high byte as lookup texture coordinates
+static void test_lut_index()
+{
+  for ( uint32_t d = 0; d < 65536; d++ )
+  {
+    float depth = (float)d;
+    float high = floorf( depth / 256.0f );
+    int x = (int)(depth - high * 256.0f);
+    if ( x != (int)(d & 255) || (int)high != (int)(d >> 8) )
+    {
+      fail( "depth " + to_string(d) + " looks up " + to_string(x) + "," + to_string((int)high) );
+      return;
+    }
+  }
+}
+
+static void test_effect_source( const char * path )
+{
+  ifstream in( path );
+  if ( !in )
+  {
+    fail( string("could not read ") + path );
+    return;
+  }
+  stringstream text;
+  text << in.rdbuf();
+  for ( const char * line : EMULATED_LINES )
+  {
+    if ( text.str().find( line ) == string::npos )
+      fail( string(path) + " no longer has \"" + line + "\", update emulation in this test" );
+  }
+}
+
+int main( int argc, char ** argv )
+{
+  test_load_depth();
+  test_lut_index();
+  vector<uint16_t> clamp_mins { 0, 1, 99, 100, 101, 10000, 35500, 39400, 65435, 65534, 65535 };
+  for ( uint32_t c = 0; c < 65536; c += 37 ) clamp_mins.push_back( (uint16_t)c );
+  for ( uint16_t clamp_min : clamp_mins ) test_gray( clamp_min );
+  if ( argc > 1 ) test_effect_source( argv[1] );
+
+  printf( "%zu clamp minimums, %s\n", clamp_mins.size(),
+          failures == 0 ? "GPU quantization matches CPU" : "GPU quantization DIFFERS" );
+  return failures == 0 ? 0 : 1;
+}
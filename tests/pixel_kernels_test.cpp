@@ -0,0 +1,206 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+// Checks every pixel kernel implementation the running CPU supports
+// against the scalar reference: random rows of many lengths, odd ones
+// included, starting at unaligned addresses, and every 16-bit depth value
+// with several clamp minimums. Output must be bit-exact and nothing may be
+// written past the end of a row. Exits with status 1 on any difference.
+#include "pixel_kernels.h"
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+using namespace std;
+
+// bytes after each output row that must stay untouched
+static const size_t GUARD_BYTES = 64;
+static const uint8_t GUARD = 0xA5;
+
+static size_t failures = 0;
+
+static void fail( const pixel_kernels & k, const string & kernel, size_t pixels, const string & detail )
+{
+  if ( failures++ < 20 )
+    printf( "FAILED: %s %s, %zu pixels: %s\n", k.name, kernel.c_str(), pixels, detail.c_str() );
+}
+
+// Compares pixels RGBA outputs of reference and tested kernel, and guard
+// bytes after the tested one.
+static void compare( const pixel_kernels & k, const string & kernel, size_t pixels,
+                     const vector<uint8_t> & expected, const vector<uint8_t> & actual, size_t offset )
+{
+  for ( size_t i = 0; i < pixels * 4; i++ )
+  {
+    if ( expected[offset + i] != actual[offset + i] )
+    {
+      fail( k, kernel, pixels, "byte " + to_string(i) + " is " + to_string(actual[offset + i]) +
+                               ", expected " + to_string(expected[offset + i]) );
+      return;
+    }
+  }
+  for ( size_t i = pixels * 4; i < pixels * 4 + GUARD_BYTES; i++ )
+  {
+    if ( actual[offset + i] != GUARD )
+    {
+      fail( k, kernel, pixels, "wrote past end of row" );
+      return;
+    }
+  }
+}
+
+static vector<size_t> row_lengths()
+{
+  vector<size_t> lengths;
+  for ( size_t n = 0; n <= 80; n++ ) lengths.push_back(n);
+  for ( size_t n : { 127, 128, 129, 255, 423, 424, 847, 848, 1279, 1280, 1921 } ) lengths.push_back(n);
+  return lengths;
+}
+
+static void test_color( const pixel_kernels & k, mt19937 & rng )
+{
+  const pixel_kernels & ref = scalar_pixel_kernels();
+  for ( size_t pixels : row_lengths() )
+  {
+    for ( size_t offset = 0; offset < 4; offset++ )
+    {
+      vector<uint8_t> src( offset + pixels * 3 + 4 );
+      for ( auto & b : src ) b = (uint8_t)rng();
+      vector<uint8_t> expected( offset + pixels * 4 + GUARD_BYTES, GUARD ), actual = expected;
+      ref.rgb_to_rgba( src.data() + offset, expected.data() + offset, pixels );
+      k.rgb_to_rgba( src.data() + offset, actual.data() + offset, pixels );
+      compare( k, "rgb_to_rgba", pixels, expected, actual, offset );
+
+      // odd counts read the whole last pair
+      vector<uint8_t> yuyv( offset + (pixels + 1) / 2 * 4 );
+      for ( auto & b : yuyv ) b = (uint8_t)rng();
+      expected.assign( expected.size(), GUARD );
+      actual = expected;
+      ref.yuyv_to_rgba( yuyv.data() + offset, expected.data() + offset, pixels );
+      k.yuyv_to_rgba( yuyv.data() + offset, actual.data() + offset, pixels );
+      compare( k, "yuyv_to_rgba", pixels, expected, actual, offset );
+    }
+  }
+}
+
+static void test_depth_rows( const pixel_kernels & k, mt19937 & rng, const vector<uint32_t> & lut )
+{
+  const pixel_kernels & ref = scalar_pixel_kernels();
+  for ( size_t pixels : row_lengths() )
+  {
+    for ( bool upsample : { false, true } )
+    {
+      size_t src_pixels = upsample ? (pixels + 1) / 2 : pixels;
+      vector<uint16_t> src( src_pixels + 1 );
+      for ( auto & d : src ) d = (uint16_t)rng();
+      vector<uint8_t> expected( pixels * 4 + GUARD_BYTES, GUARD ), actual = expected;
+      uint16_t clamp_min = (uint16_t)(rng() % 20000);
+      ref.depth_to_gray( src.data(), expected.data(), pixels, clamp_min, upsample );
+      k.depth_to_gray( src.data(), actual.data(), pixels, clamp_min, upsample );
+      compare( k, upsample ? "depth_to_gray upsampled" : "depth_to_gray", pixels, expected, actual, 0 );
+
+      expected.assign( expected.size(), GUARD );
+      actual = expected;
+      ref.depth_lookup( src.data(), lut.data(), expected.data(), pixels, upsample );
+      k.depth_lookup( src.data(), lut.data(), actual.data(), pixels, upsample );
+      compare( k, upsample ? "depth_lookup upsampled" : "depth_lookup", pixels, expected, actual, 0 );
+
+      expected.assign( expected.size(), GUARD );
+      actual = expected;
+      ref.depth_pack( src.data(), expected.data(), pixels, upsample );
+      k.depth_pack( src.data(), actual.data(), pixels, upsample );
+      compare( k, upsample ? "depth_pack upsampled" : "depth_pack", pixels, expected, actual, 0 );
+    }
+  }
+}
+
+// Every depth value in one long row, with clamp minimums at and around the
+// edges of the 8-bit range.
+static void test_all_depths( const pixel_kernels & k, const vector<uint32_t> & lut )
+{
+  const pixel_kernels & ref = scalar_pixel_kernels();
+  const size_t pixels = 65536;
+  vector<uint16_t> src( pixels );
+  for ( size_t d = 0; d < pixels; d++ ) src[d] = (uint16_t)d;
+  vector<uint8_t> expected( pixels * 4 + GUARD_BYTES, GUARD ), actual = expected;
+  for ( uint16_t clamp_min : { 0, 1, 99, 100, 101, 10000, 35500, 39400, 65435, 65535 } )
+  {
+    expected.assign( expected.size(), GUARD );
+    actual = expected;
+    ref.depth_to_gray( src.data(), expected.data(), pixels, clamp_min, false );
+    k.depth_to_gray( src.data(), actual.data(), pixels, clamp_min, false );
+    compare( k, "depth_to_gray clamp " + to_string(clamp_min), pixels, expected, actual, 0 );
+  }
+  expected.assign( expected.size(), GUARD );
+  actual = expected;
+  ref.depth_lookup( src.data(), lut.data(), expected.data(), pixels, false );
+  k.depth_lookup( src.data(), lut.data(), actual.data(), pixels, false );
+  compare( k, "depth_lookup all values", pixels, expected, actual, 0 );
+
+  expected.assign( expected.size(), GUARD );
+  actual = expected;
+  ref.depth_pack( src.data(), expected.data(), pixels, false );
+  k.depth_pack( src.data(), actual.data(), pixels, false );
+  compare( k, "depth_pack all values", pixels, expected, actual, 0 );
+}
+
+// every Y, U and V combination through single pixel formula, against scalar row kernel
+static void test_yuyv_values()
+{
+  const pixel_kernels & ref = scalar_pixel_kernels();
+  vector<uint8_t> src( 256 * 4 ), dst( 256 * 2 * 4 );
+  for ( int u = 0; u < 256; u++ )
+    for ( int v = 0; v < 256; v++ )
+    {
+      for ( int y = 0; y < 256; y++ )
+      {
+        src[y * 4] = (uint8_t)y;
+        src[y * 4 + 1] = (uint8_t)u;
+        src[y * 4 + 2] = (uint8_t)(255 - y);
+        src[y * 4 + 3] = (uint8_t)v;
+      }
+      ref.yuyv_to_rgba( src.data(), dst.data(), 512 );
+      for ( int y = 0; y < 256; y++ )
+      {
+        uint32_t expected = yuyv_to_rgba_value( (uint8_t)y, (uint8_t)u, (uint8_t)v ), actual;
+        memcpy( &actual, dst.data() + y * 8, 4 );
+        if ( actual != expected ) { fail( ref, "yuyv_to_rgba_value", 1, "differs from row kernel" ); return; }
+      }
+    }
+}
+
+int main()
+{
+  mt19937 rng(2021);
+  vector<uint32_t> lut( 65536 );
+  for ( auto & entry : lut ) entry = (uint32_t)rng();
+
+  test_yuyv_values();
+  vector<const pixel_kernels *> kernels = supported_pixel_kernels();
+  for ( const pixel_kernels * k : kernels )
+  {
+    size_t before = failures;
+    test_color( *k, rng );
+    test_depth_rows( *k, rng, lut );
+    test_all_depths( *k, lut );
+    printf( "%-8s %s\n", k->name, failures == before ? "bit-exact with scalar" : "DIFFERS" );
+  }
+  if ( kernels.size() == 1 ) printf( "only scalar kernels are supported here, nothing else to compare\n" );
+  return failures == 0 ? 0 : 1;
+}
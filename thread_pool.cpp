@@ -0,0 +1,213 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "thread_pool.h"
+#include <algorithm>
+using namespace std;
+
+thread_pool::thread_pool( size_t thread_count ) : tasks(INITIAL_TASK_CAPACITY)
+{
+  for ( size_t i = 0; i < max<size_t>(thread_count, 1); i++ )
+  {
+    threads.push_back(thread(run, this));
+  }
+}
+
+thread_pool::~thread_pool()
+{
+  {
+    lock_guard<mutex> lock(tasks_mutex);
+    stopping = true;
+  }
+  task_added.notify_all();
+  for ( auto & t : threads ) t.join();
+}
+
+size_t thread_pool::default_thread_count()
+{
+  // hardware_concurrency may return 0 when it does not know
+  return max<size_t>(thread::hardware_concurrency(), 1);
+}
+
+void thread_pool::submit( pool_task * task )
+{
+  {
+    lock_guard<mutex> lock(tasks_mutex);
+    if ( task_count == tasks.size() )
+    {
+      // unroll ring into a larger one
+      vector<pool_task*> larger(tasks.size() * 2);
+      for ( size_t i = 0; i < task_count; i++ ) larger[i] = tasks[(first_task + i) % tasks.size()];
+      tasks.swap(larger);
+      first_task = 0;
+    }
+    tasks[(first_task + task_count) % tasks.size()] = task;
+    task_count++;
+  }
+  task_added.notify_one();
+}
+
+void thread_pool::run( thread_pool * pool )
+{
+  while ( true )
+  {
+    pool_task *task;
+    {
+      unique_lock<mutex> lock(pool->tasks_mutex);
+      pool->task_added.wait(lock, [pool]{ return pool->stopping || pool->task_count > 0; });
+      if ( pool->task_count == 0 ) return;
+      task = pool->tasks[pool->first_task];
+      pool->first_task = (pool->first_task + 1) % pool->tasks.size();
+      pool->task_count--;
+    }
+    task->run();
+  }
+}
+
+pool_task::pool_task( thread_pool & p, const std::function<void()> & f ) : pool(p), work(f)
+{
+}
+
+void pool_task::schedule()
+{
+  // only the call that finds task idle queues it, others are picked up by run()
+  if ( pending.fetch_add(1) == 0 ) pool.submit(this);
+}
+
+void pool_task::run()
+{
+  uint32_t handled = pending.load();
+  while ( true )
+  {
+    work();
+    // decrement under lock, wait_idle() may destroy task as soon as it sees zero
+    lock_guard<mutex> lock(idle_mutex);
+    uint32_t left = pending.fetch_sub(handled) - handled;
+    if ( left == 0 )
+    {
+      idle.notify_all();
+      return;
+    }
+    handled = left;
+  }
+}
+
+void pool_task::wait_idle()
+{
+  unique_lock<mutex> lock(idle_mutex);
+  idle.wait(lock, [this]{ return pending == 0; });
+}
+
+parallel_tiles::parallel_tiles( thread_pool & pool, size_t workers ) :
+  pool(pool), worker_count(1)
+{
+  for ( size_t i = 0; i < MAX_WORKERS; i++ ) shares[i] = 0;
+  set_workers(workers);
+}
+
+void parallel_tiles::set_workers( size_t workers )
+{
+  workers = min<size_t>(max<size_t>(workers, 1), MAX_WORKERS);
+  for ( size_t i = helpers.size() + 1; i < workers; i++ )
+  {
+    helpers.push_back(new pool_task(pool, [this, i]{ work(i); }));
+  }
+  worker_count = workers;
+}
+
+parallel_tiles::~parallel_tiles()
+{
+  // pool_task destructor waits for helpers that are still queued or running
+  for ( auto helper : helpers ) delete helper;
+}
+
+static uint64_t pack_share( uint32_t first, uint32_t end )
+{
+  return (uint64_t)first << 32 | end;
+}
+
+bool parallel_tiles::take_own( size_t participant, uint32_t & tile )
+{
+  uint64_t share = shares[participant].load();
+  while ( true )
+  {
+    uint32_t first = (uint32_t)(share >> 32), end = (uint32_t)share;
+    if ( first >= end ) return false;
+    if ( shares[participant].compare_exchange_weak(share, pack_share(first + 1, end)) )
+    {
+      tile = first;
+      return true;
+    }
+  }
+}
+
+bool parallel_tiles::steal( size_t victim, uint32_t & tile )
+{
+  uint64_t share = shares[victim].load();
+  while ( true )
+  {
+    uint32_t first = (uint32_t)(share >> 32), end = (uint32_t)share;
+    if ( first >= end ) return false;
+    if ( shares[victim].compare_exchange_weak(share, pack_share(first, end - 1)) )
+    {
+      tile = end - 1;
+      return true;
+    }
+  }
+}
+
+void parallel_tiles::work( size_t participant )
+{
+  uint32_t tile;
+  while ( true )
+  {
+    // a late helper may find count lowered under its index, it then only steals
+    size_t count = worker_count;
+    bool found = take_own(participant, tile);
+    for ( size_t i = 1; !found && i <= count; i++ )
+    {
+      size_t victim = (participant + i) % count;
+      if ( victim != participant ) found = steal(victim, tile);
+    }
+    if ( !found ) return;
+    // function stays valid while any tile of the job is incomplete
+    job_function(job_context, tile);
+    completed.fetch_add(1);
+  }
+}
+
+void parallel_tiles::run( size_t tile_count, tile_function function, void * context )
+{
+  if ( worker_count == 1 || tile_count < 2 )
+  {
+    for ( size_t t = 0; t < tile_count; t++ ) function(context, t);
+    return;
+  }
+  job_function = function;
+  job_context = context;
+  completed = 0;
+  for ( size_t i = 0; i < worker_count; i++ )
+  {
+    shares[i] = pack_share((uint32_t)(tile_count * i / worker_count),
+                           (uint32_t)(tile_count * (i + 1) / worker_count));
+  }
+  for ( size_t i = 1; i < worker_count; i++ ) helpers[i - 1]->schedule();
+  work(0);
+  // tiles taken by others may still be running, they are short
+  while ( completed.load() < tile_count ) this_thread::yield();
+}
@@ -0,0 +1,117 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class pool_task;
+
+// Fixed set of threads shared by all cameras, running pool_tasks as they
+// get scheduled. Tasks still queued when the pool is destroyed are run
+// before the threads exit.
+class thread_pool
+{
+public:
+  explicit thread_pool( size_t thread_count = default_thread_count() );
+  virtual ~thread_pool();
+  size_t size() const { return threads.size(); }
+  // one thread per core
+  static size_t default_thread_count();
+protected:
+  friend class pool_task;
+  void submit( pool_task * task );
+  static void run( thread_pool * pool );
+  static const size_t INITIAL_TASK_CAPACITY = 64;
+
+  std::vector<std::thread> threads;
+  // Ring of queued tasks. A task is queued at most once at a time, so this
+  // only grows until it holds every task and never allocates after that.
+  std::vector<pool_task*> tasks;
+  size_t first_task{ 0 };
+  size_t task_count{ 0 };
+  std::mutex tasks_mutex;
+  std::condition_variable task_added;
+  bool stopping{ false };
+};
+
+// Function run on a thread_pool whenever schedule() is called, but never on
+// more than one thread at a time. Calls made while it is running make it
+// run once more afterwards, so work posted meanwhile is never missed.
+class pool_task
+{
+public:
+  pool_task( thread_pool & pool, const std::function<void()> & work );
+  virtual ~pool_task() { wait_idle(); }
+  void schedule();
+  // blocks until task is neither running nor scheduled
+  void wait_idle();
+protected:
+  friend class thread_pool;
+  void run();
+
+  thread_pool & pool;
+  std::function<void()> work;
+  std::atomic<uint32_t> pending{ 0 };
+  std::mutex idle_mutex;
+  std::condition_variable idle;
+};
+
+// Runs tiles of one job on the calling thread and helper tasks of a
+// thread_pool. Each participant starts from its own contiguous share of
+// tiles and, once done, steals from the end of the others' shares, so a
+// helper that starts late or runs slow does not hold the job back. Caller
+// always participates, so jobs finish even when every pool thread is busy.
+class parallel_tiles
+{
+public:
+  typedef void (*tile_function)( void * context, size_t tile );
+  enum { MAX_WORKERS = 64 };
+
+  // workers counts caller too, so 1 runs everything on calling thread
+  parallel_tiles( thread_pool & pool, size_t workers );
+  // Waits for helpers, so must not be called from a task of the pool.
+  virtual ~parallel_tiles();
+  size_t workers() const { return worker_count; }
+  // Changes number of workers for following runs. Helpers are only ever
+  // added, a helper left over from a larger count finds no tiles of its
+  // own and steals or returns, so this never waits on the pool and can be
+  // called from a pool task between runs.
+  void set_workers( size_t workers );
+  // Calls function for every tile in 0 - tile_count and returns when all are done.
+  void run( size_t tile_count, tile_function function, void * context );
+protected:
+  // works on share of participant until no tile is left anywhere
+  void work( size_t participant );
+  bool take_own( size_t participant, uint32_t & tile );
+  bool steal( size_t victim, uint32_t & tile );
+
+  thread_pool & pool;
+  // read by helpers that may run late, changed only between runs
+  std::atomic<size_t> worker_count;
+  std::vector<pool_task *> helpers;
+  // first and one past last tile of each participant's share, packed as first << 32 | end
+  std::atomic<uint64_t> shares[MAX_WORKERS];
+  std::atomic<size_t> completed{ 0 };
+  tile_function job_function{ nullptr };
+  void * job_context{ nullptr };
+};
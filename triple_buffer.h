@@ -0,0 +1,59 @@
+/*
+  Copyright (C) 2021 anssi.grohn@karelia.fi
+  
+  This file is part of realsense-obs-plugin.
+  
+  realsense-obs-plugin is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  
+  realsense-obs-plugin is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  
+  You should have received a copy of the GNU General Public License
+  along with realsense-obs-plugin.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Lock-free single producer, single consumer triple buffer. Producer always
+// has a free buffer to write into and consumer always picks up the most
+// recently completed one; older unconsumed results are simply overwritten.
+template <class T>
+class triple_buffer
+{
+public:
+  // Buffer the producer may write into.
+  T & write_buffer() { return buffers[back]; }
+  // Producer marks write buffer complete and gets a new one to write into.
+  void publish()
+  {
+    back = middle.exchange( back | FRESH ) & INDEX;
+  }
+  // Consumer takes newest completed buffer into use. Returns false if nothing
+  // was published since previous call, read_buffer() then stays the same.
+  bool acquire()
+  {
+    if ( (middle.load() & FRESH) == 0 ) return false;
+    front = middle.exchange( front ) & INDEX;
+    return true;
+  }
+  // Buffer the consumer is reading.
+  T & read_buffer() { return buffers[front]; }
+  // Direct access for initialization, only when neither side is running.
+  T & operator[]( size_t i ) { return buffers[i]; }
+  enum { count = 3 };
+protected:
+  static const uint8_t INDEX = 0x3;
+  static const uint8_t FRESH = 0x4;
+  T buffers[3];
+  uint8_t back{ 0 };
+  uint8_t front{ 1 };
+  std::atomic<uint8_t> middle{ 2 };
+};